@@ -0,0 +1,30 @@
+/*
+ * Format of the power-up SRAM samples recorded by the collection utility.
+ *
+ * The author has waived all copyright and related or neighbouring rights
+ * to this file and placed it in public domain.
+ */
+
+#ifndef COLLECT_H_INCLUDED
+#define COLLECT_H_INCLUDED
+
+#include <stdint.h>
+
+enum {
+    PORTION         = 16384,        // bytes of SRAM per sample
+    LOGSEC          = 5,            // log2 of the interval between samples
+    RECORD_BLOCK    = 512,          // SD card block size
+    // Each record on the SD card is a header block followed by the sample.
+    RECORD_BLOCKS   = 1 + PORTION / RECORD_BLOCK,
+};
+
+// The header block, padded with zeros to RECORD_BLOCK bytes.
+// Fields are in the native (little endian) byte order.
+struct Record_header {
+    uint32_t cycle;             // record number, equals its position on card
+    uint32_t temperature;       // in units of 0.5 degrees Celsius, if known
+    uint32_t size;              // sample size in bytes (PORTION)
+    uint32_t interval;          // seconds between samples
+};
+
+#endif
@@ -36,12 +36,7 @@
 #include "temperature.h"
 #endif
 #include "sys/stdio-uart.h"
-
-
-enum {
-    PORTION = 16384,
-    LOGSEC  = 5,
-};
+#include "collect.h"
 
 
 // Initialise AST.
@@ -174,15 +169,18 @@ int main(void)
     }
 
     if (sd_capacity) {
-        uint32_t blk[SD_MMC_BLOCK_SIZE / sizeof (uint32_t)];
-        memset(blk, 0, sizeof blk);
-        blk[0] = cycle;
-        blk[1] = t;
-        blk[2] = PORTION;
-        blk[3] = 1 << LOGSEC;
+        union {
+            struct Record_header hdr;
+            uint32_t words[SD_MMC_BLOCK_SIZE / sizeof (uint32_t)];
+        } blk;
+        memset(&blk, 0, sizeof blk);
+        blk.hdr.cycle = cycle;
+        blk.hdr.temperature = t;
+        blk.hdr.size = PORTION;
+        blk.hdr.interval = 1 << LOGSEC;
         if (sd_mmc_init_write_blocks(0, start, 1 + PORTION / SD_MMC_BLOCK_SIZE) == SD_MMC_OK) {
             sd_mmc_err_t e1, e2, e3;
-            e1 = sd_mmc_start_write_blocks(blk, 1);
+            e1 = sd_mmc_start_write_blocks(blk.words, 1);
             e2 = sd_mmc_wait_end_of_write_blocks();
             e3 = sd_mmc_start_write_blocks(page, PORTION / SD_MMC_BLOCK_SIZE);
             if (e1 | e2 | e3)
@@ -0,0 +1,416 @@
+/*
+ * Entropy assessment of power-up SRAM samples collected on an SD card.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Usage: assess [-j threads] [-o prefix] image
+//
+// The image is a raw copy of the SD card (or a file made by dd from it).
+// Records are read until the first one with an invalid header, which is
+// normally the first block not yet written by the collection firmware.
+//
+// Statistics computed:
+//  - per bit position: probability of 1 over all records, probability of
+//    flipping between consecutive records, and the SP 800-90B most common
+//    value min-entropy estimate (with the 99% upper confidence bound);
+//  - Hamming distance between consecutive records;
+//  - SP 800-90B most common value (8-bit samples) and Markov (1-bit samples)
+//    estimates within each record.
+// Per-bit maps are written as PGM images, one pixel per bit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "collect.h"
+
+
+enum {
+    NBITS       = PORTION * 8,
+    NWORDS      = PORTION / 8,      // 64-bit words per sample
+    RECORD_SIZE = RECORD_BLOCKS * RECORD_BLOCK,
+    MAP_WIDTH   = 512,              // heatmap width in bits
+    PLANES      = 8,                // bit-sliced counters hold up to 255
+};
+
+static const uint8_t *image;
+static unsigned num_records;
+
+static inline const uint64_t *sample(unsigned rec)
+{
+    return (const uint64_t *)(image + (size_t)rec * RECORD_SIZE + RECORD_BLOCK);
+}
+
+// Per-thread accumulators.
+struct Job {
+    pthread_t thread;
+    unsigned first, last;           // records [first, last)
+
+    // Bit-sliced vertical counters: bit j of planes[w][k] is bit k of the
+    // counter for bit position w*64+j.  This lets us add a whole sample
+    // with a few word operations per 64 positions.
+    uint64_t (*ones_planes)[PLANES];
+    uint64_t (*flip_planes)[PLANES];
+    unsigned pending;               // additions since the last flush
+    uint32_t *ones;                 // NBITS counters
+    uint32_t *flips;
+
+    uint64_t hd_sum;                // inter-cycle Hamming distance
+    double   hd_sumsq;
+    unsigned hd_min, hd_max;
+};
+
+// Per-record estimates, indexed by record number.
+static float *mcv8;
+static float *markov;
+static float *bias;
+
+static void vadd(uint64_t (*planes)[PLANES], unsigned w, uint64_t x)
+{
+    for (unsigned k = 0; x; k++) {
+        uint64_t carry = planes[w][k] & x;
+        planes[w][k] ^= x;
+        x = carry;
+    }
+}
+
+static void flush(uint64_t (*planes)[PLANES], uint32_t *counts)
+{
+    for (unsigned w = 0; w < NWORDS; w++) {
+        for (unsigned k = 0; k < PLANES; k++) {
+            uint64_t p = planes[w][k];
+            for (; p; p &= p - 1)
+                counts[w * 64 + __builtin_ctzll(p)] += 1u << k;
+        }
+    }
+    memset(planes, 0, sizeof (uint64_t [NWORDS][PLANES]));
+}
+
+// SP 800-90B 6.3.1: most common value estimate.
+static double mcv_estimate(unsigned max_count, unsigned len)
+{
+    double p = (double) max_count / len;
+    double pu = p + 2.576 * sqrt(p * (1 - p) / (len - 1));
+    return pu >= 1 ? 0 : -log2(pu);
+}
+
+// SP 800-90B 6.3.3: Markov estimate for a binary sequence, per bit.
+static double markov_estimate(const uint64_t *x)
+{
+    unsigned ones = 0, c[2][2] = { { 0 } };
+
+    for (unsigned w = 0; w < NWORDS; w++) {
+        uint64_t a = x[w];
+        // next bit of the sequence for each bit of a
+        uint64_t b = a >> 1 | (w + 1 < NWORDS ? x[w + 1] << 63 : 0);
+        unsigned pairs = w + 1 < NWORDS ? 64 : 63;
+        uint64_t mask = pairs == 64 ? ~0ull : ~0ull >> 1;
+        ones += __builtin_popcountll(a);
+        c[1][1] += __builtin_popcountll(a & b & mask);
+        c[1][0] += __builtin_popcountll(a & ~b & mask);
+        c[0][1] += __builtin_popcountll(~a & b & mask);
+        c[0][0] += __builtin_popcountll(~a & ~b & mask);
+    }
+
+    double p1 = (double) ones / NBITS, p0 = 1 - p1;
+    double n0 = c[0][0] + c[0][1], n1 = c[1][0] + c[1][1];
+    double p00 = n0 ? c[0][0] / n0 : 0, p01 = n0 ? c[0][1] / n0 : 0;
+    double p10 = n1 ? c[1][0] / n1 : 0, p11 = n1 ? c[1][1] / n1 : 0;
+
+    double seq[] = {
+        p0 * pow(p00, 127),
+        p0 * p01 * pow(p11, 126),
+        p0 * pow(p01, 64) * pow(p10, 63),
+        p1 * p10 * pow(p00, 126),
+        p1 * pow(p10, 64) * pow(p01, 63),
+        p1 * pow(p11, 127),
+    };
+    double pmax = 0;
+    for (unsigned i = 0; i < sizeof seq / sizeof seq[0]; i++)
+        if (seq[i] > pmax)
+            pmax = seq[i];
+
+    double h = -log2(pmax) / 128;
+    return h > 1 ? 1 : h;
+}
+
+static void *worker(void *arg)
+{
+    struct Job *job = arg;
+
+    for (unsigned rec = job->first; rec < job->last; rec++) {
+        const uint64_t *x = sample(rec);
+        const uint64_t *prev = rec ? sample(rec - 1) : 0;
+        unsigned hist[256] = { 0 };
+        unsigned ones = 0, hd = 0;
+
+        for (unsigned w = 0; w < NWORDS; w++) {
+            uint64_t v = x[w];
+            ones += __builtin_popcountll(v);
+            vadd(job->ones_planes, w, v);
+            if (prev) {
+                uint64_t d = v ^ prev[w];
+                hd += __builtin_popcountll(d);
+                vadd(job->flip_planes, w, d);
+            }
+            for (unsigned i = 0; i < 8; i++)
+                hist[v >> i * 8 & 0xff]++;
+        }
+
+        if (++job->pending == 255) {
+            flush(job->ones_planes, job->ones);
+            flush(job->flip_planes, job->flips);
+            job->pending = 0;
+        }
+
+        if (prev) {
+            job->hd_sum += hd;
+            job->hd_sumsq += (double) hd * hd;
+            if (hd < job->hd_min)
+                job->hd_min = hd;
+            if (hd > job->hd_max)
+                job->hd_max = hd;
+        }
+
+        unsigned max = 0;
+        for (unsigned i = 0; i < 256; i++)
+            if (hist[i] > max)
+                max = hist[i];
+        mcv8[rec] = mcv_estimate(max, PORTION);
+        markov[rec] = markov_estimate(x);
+        bias[rec] = (float) ones / NBITS;
+    }
+
+    flush(job->ones_planes, job->ones);
+    flush(job->flip_planes, job->flips);
+    return 0;
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_range(const char *name, float *v, unsigned n, const char *unit)
+{
+    qsort(v, n, sizeof *v, cmp_float);
+    printf("%-32s min %.4f  median %.4f  max %.4f %s\n", name,
+            v[0], v[n / 2], v[n - 1], unit);
+}
+
+static bool write_map(const char *prefix, const char *name, const double *v)
+{
+    char fname[256];
+    snprintf(fname, sizeof fname, "%s%s.pgm", prefix, name);
+    FILE *f = fopen(fname, "wb");
+    if (!f) {
+        perror(fname);
+        return false;
+    }
+    fprintf(f, "P5\n%d %d\n255\n", MAP_WIDTH, NBITS / MAP_WIDTH);
+    for (unsigned i = 0; i < NBITS; i++)
+        fputc((int) lrint(v[i] * 255), f);
+    fclose(f);
+    printf("Wrote %s.\n", fname);
+    return true;
+}
+
+static void usage(void)
+{
+    puts("Usage: assess [-j threads] [-o prefix] image");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *prefix = "";
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:o:")) != -1) {
+        switch (opt) {
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1 || nthreads < 1)
+        usage();
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        perror(argv[optind]);
+        return 1;
+    }
+    size_t len = st.st_size;
+    if (len < RECORD_SIZE) {
+        fprintf(stderr, "%s: too short\n", argv[optind]);
+        return 1;
+    }
+    image = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise((void *)image, len, MADV_SEQUENTIAL);
+
+    // Find the valid records.
+    int tmin = INT32_MAX, tmax = INT32_MIN;
+    for (num_records = 0; (size_t)(num_records + 1) * RECORD_SIZE <= len;
+            num_records++) {
+        const struct Record_header *hdr =
+            (const void *)(image + (size_t)num_records * RECORD_SIZE);
+        if (hdr->cycle != num_records || hdr->size != PORTION)
+            break;
+        if (hdr->temperature) {
+            int t = (int32_t) hdr->temperature;
+            if (t < tmin)
+                tmin = t;
+            if (t > tmax)
+                tmax = t;
+        }
+    }
+    if (num_records < 2) {
+        fprintf(stderr, "%s: need at least 2 valid records, found %u\n",
+                argv[optind], num_records);
+        return 1;
+    }
+    printf("%u records of %u bytes, interval %u s.\n", num_records, PORTION,
+            ((const struct Record_header *)image)->interval);
+    if (tmin <= tmax)
+        printf("Temperature %.1f to %.1f C.\n", tmin * 0.5, tmax * 0.5);
+
+    if (nthreads > num_records)
+        nthreads = num_records;
+    printf("Using %ld threads.\n", nthreads);
+
+    mcv8 = malloc(num_records * sizeof *mcv8);
+    markov = malloc(num_records * sizeof *markov);
+    bias = malloc(num_records * sizeof *bias);
+    struct Job *jobs = calloc(nthreads, sizeof *jobs);
+    if (!mcv8 || !markov || !bias || !jobs)
+        goto nomem;
+
+    for (long i = 0; i < nthreads; i++) {
+        struct Job *job = &jobs[i];
+        job->first = (uint64_t) num_records * i / nthreads;
+        job->last = (uint64_t) num_records * (i + 1) / nthreads;
+        job->ones_planes = calloc(NWORDS, sizeof *job->ones_planes);
+        job->flip_planes = calloc(NWORDS, sizeof *job->flip_planes);
+        job->ones = calloc(NBITS, sizeof *job->ones);
+        job->flips = calloc(NBITS, sizeof *job->flips);
+        job->hd_min = NBITS;
+        if (!job->ones_planes || !job->flip_planes || !job->ones || !job->flips)
+            goto nomem;
+        if (pthread_create(&job->thread, 0, worker, job)) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    uint64_t hd_sum = 0;
+    double hd_sumsq = 0;
+    unsigned hd_min = NBITS, hd_max = 0;
+    for (long i = 0; i < nthreads; i++) {
+        struct Job *job = &jobs[i];
+        pthread_join(job->thread, 0);
+        if (i) {
+            for (unsigned b = 0; b < NBITS; b++) {
+                jobs[0].ones[b] += job->ones[b];
+                jobs[0].flips[b] += job->flips[b];
+            }
+        }
+        hd_sum += job->hd_sum;
+        hd_sumsq += job->hd_sumsq;
+        if (job->hd_min < hd_min)
+            hd_min = job->hd_min;
+        if (job->hd_max > hd_max)
+            hd_max = job->hd_max;
+    }
+
+    // Per-bit-position statistics.
+    double *p1 = malloc(NBITS * sizeof *p1);
+    double *pf = malloc(NBITS * sizeof *pf);
+    double *h = malloc(NBITS * sizeof *h);
+    if (!p1 || !pf || !h)
+        goto nomem;
+
+    double total = 0;
+    unsigned stuck = 0, biased = 0;
+    for (unsigned b = 0; b < NBITS; b++) {
+        unsigned n = jobs[0].ones[b];
+        p1[b] = (double) n / num_records;
+        pf[b] = (double) jobs[0].flips[b] / (num_records - 1);
+        h[b] = mcv_estimate(n > num_records - n ? n : num_records - n,
+                num_records);
+        total += h[b];
+        stuck += n == 0 || n == num_records;
+        biased += p1[b] < 0.1 || p1[b] > 0.9;
+    }
+
+    double hd_mean = (double) hd_sum / (num_records - 1);
+    double hd_sd = sqrt(hd_sumsq / (num_records - 1) - hd_mean * hd_mean);
+
+    puts("\nAcross records, per bit position:");
+    printf("  stuck bits:                    %u of %u (%.2f%%)\n",
+            stuck, NBITS, stuck * 100.0 / NBITS);
+    printf("  bits with p(1) < 0.1 or > 0.9: %u (%.2f%%)\n",
+            biased, biased * 100.0 / NBITS);
+    printf("  MCV min-entropy:               %.0f bits total, %.4f per bit\n",
+            total, total / NBITS);
+    printf("  inter-cycle Hamming distance:  min %u  mean %.1f  sd %.1f  "
+            "max %u (mean %.4f per bit)\n",
+            hd_min, hd_mean, hd_sd, hd_max, hd_mean / NBITS);
+
+    puts("\nWithin records:");
+    print_range("  fraction of ones:", bias, num_records, "");
+    print_range("  MCV estimate, 8-bit samples:", mcv8, num_records, "bits/byte");
+    print_range("  Markov estimate, 1-bit samples:", markov, num_records, "bits/bit");
+
+    // rng_init() extracts the seed with SHA-512.
+    if (total > 0)
+        printf("\nSRAM needed for 512 bits of min-entropy: %.0f bytes.\n",
+                512 * PORTION / total);
+    if (num_records < 1000)
+        puts("Warning: too few records for reliable per-position estimates.");
+
+    putchar('\n');
+    bool ok = write_map(prefix, "bias", p1)
+        & write_map(prefix, "flips", pf)
+        & write_map(prefix, "entropy", h);
+
+    return !ok;
+
+nomem:
+    fputs("Out of memory.\n", stderr);
+    return 1;
+}
@@ -22,12 +22,14 @@
  * - append 4-byte double SHA-256 checksum
  * - encode the result in base-58
  * - prepend ones as necessary to indicate leading zero bytes, if present.
+ * Decoding does the reverse and verifies the checksum.
  */
 
 #ifndef BASE58_H_INCLUDED
 #define BASE58_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "secp256k1.h"
 
 // Base-58 mapping: "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz"
@@ -36,6 +38,13 @@ extern const char base58_map[];
 // Encode len bytes of data into b58_buf.
 void base58check_encode(const unsigned char *data, int len, char *b58_buf);
 
+// Decode Base58Check string into out, which can hold maxlen bytes.
+// Return the number of bytes without the checksum, or -1 if the string is
+// invalid, doesn't fit or fails the checksum.
+// The _len version takes a string which is not necessarily NUL-terminated.
+int base58check_decode(const char *str, uint8_t *out, int maxlen);
+int base58check_decode_len(const char *str, int len, uint8_t *out, int maxlen);
+
 // Encode bitcoin address into b58_buf.
 // The buffer for storing Base58 output must be able to hold 35 bytes.
 // avb is the Application/Version Byte of Base58Check.
@@ -0,0 +1,104 @@
+/*
+ * Base58Check decoding
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "base58.h"
+#include "sha256.h"
+
+// Mapping of ASCII characters to Base58 code points; -1 if invalid.
+static const int8_t base58_digit[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8, -1, -1, -1, -1, -1, -1,
+    -1,  9, 10, 11, 12, 13, 14, 15, 16, -1, 17, 18, 19, 20, 21, -1,
+    22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, -1, -1, -1, -1, -1,
+    -1, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, -1, 44, 45, 46,
+    47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, -1, -1, -1, -1, -1,
+};
+
+// Decode Base58Check string of len characters into at most maxlen bytes.
+// Return the number of bytes decoded (checksum excluded), or -1 if the
+// string has invalid characters, is too long, or the checksum doesn't match.
+int base58check_decode_len(const char *str, int len, uint8_t *out, int maxlen)
+{
+    // The number is accumulated in little-endian 32-bit limbs.  Up to five
+    // digits at a time are merged into a limb-sized value (58^5 < 2^32),
+    // then the number is multiplied by 58^k and the value added.
+    uint32_t num[(maxlen + 4 + 3) / 4];
+    uint8_t bytes[maxlen + 4];
+    uint32_t hash[SHA256_SIZE / 4];
+    int nlimbs = sizeof num / sizeof num[0];
+    int used = 0;           // limbs in use
+    int zeros, i, j;
+
+    for (zeros = 0; zeros < len && str[zeros] == '1'; zeros++)
+        ;
+
+    for (i = zeros; i < len; ) {
+        uint32_t value = 0, mul = 1;
+        for (j = 0; j < 5 && i < len; j++, i++) {
+            unsigned c = (unsigned char) str[i];
+            if (c >= 128 || base58_digit[c] < 0)
+                return -1;
+            value = value * 58 + base58_digit[c];
+            mul *= 58;
+        }
+
+        uint64_t carry = value;
+        for (j = 0; j < used; j++) {
+            carry += (uint64_t) num[j] * mul;
+            num[j] = carry;
+            carry >>= 32;
+        }
+        if (carry) {
+            if (used == nlimbs)
+                return -1;
+            num[used++] = carry;
+        }
+    }
+
+    // number of significant bytes
+    int nbytes = used * 4;
+    while (nbytes && !(num[(nbytes - 1) / 4] >> (nbytes - 1) % 4 * 8 & 0xff))
+        nbytes--;
+
+    int total = zeros + nbytes;
+    if (total < 4 || total > maxlen + 4)
+        return -1;
+
+    memset(bytes, 0, zeros);
+    for (i = 0; i < nbytes; i++)
+        bytes[total - 1 - i] = num[i / 4] >> i % 4 * 8;
+
+    total -= 4;
+    sha256_twice(hash, bytes, total);
+    if (memcmp(hash, bytes + total, 4) != 0)
+        return -1;
+
+    memcpy(out, bytes, total);
+    return total;
+}
+
+int base58check_decode(const char *str, uint8_t *out, int maxlen)
+{
+    return base58check_decode_len(str, strlen(str), out, maxlen);
+}
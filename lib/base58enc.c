@@ -43,46 +43,82 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "base58.h"
 #include "sha256.h"
-#include "ripemd.h"
+#include "hash160.h"
 
 // Mapping of Base58 code points to characters.
 const char base58_map[] =
     "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
+// The number is divided by a power of 58 in each pass, producing several
+// digits at once.  The divisor is chosen so that the partial dividend
+// (remainder from the previous limb and the next limb) fits in the widest
+// integer which the CPU can divide natively.
+#if UINTPTR_MAX > 0xffffffff
+// 32-bit limbs, five digits per pass.
+typedef uint32_t b58_limb_t;
+typedef uint64_t b58_acc_t;
+enum { LIMB_BYTES = 4, LIMB_DIGITS = 5 };
+#define LIMB_RADIX  656356768u          // 58**5
+#else
+// Cortex-M4 has no 64-bit division, so use bytes and four digits per pass.
+typedef uint8_t  b58_limb_t;
+typedef uint32_t b58_acc_t;
+enum { LIMB_BYTES = 1, LIMB_DIGITS = 4 };
+#define LIMB_RADIX  11316496u           // 58**4
+#endif
+
 // Encode len bytes of data into b58_buf using Base58Check encoding.
 void base58check_encode(const unsigned char *data, int len, char *b58_buf)
 {
-    uint8_t num[len + 4];       // numerator
+    uint8_t bytes[len + 4];
+    b58_limb_t num[(len + 4 + LIMB_BYTES - 1) / LIMB_BYTES];    // numerator
     uint32_t hash[SHA256_SIZE / 4];
-    unsigned num_is_non_zero;
-    int i, j;
+    int nlimbs = sizeof num / sizeof num[0];
+    int i, j, k, top;
 
     // compute and append checksum
     sha256_twice(hash, data, len);
-    memcpy(num, data, len);
-    memcpy(num + len, hash, 4);
-    len += 4;
+    memcpy(bytes, data, len);
+    memcpy(bytes + len, hash, 4);
+
+    // convert to big-endian array of limbs; the first limb may be partial
+    for (i = 0, j = len + 4 - nlimbs * LIMB_BYTES; i < nlimbs; i++) {
+        b58_limb_t limb = 0;
+        for (k = 0; k < LIMB_BYTES; k++, j++)
+            limb = limb << 8 | (j >= 0 ? bytes[j] : 0);
+        num[i] = limb;
+    }
 
-    // compute base58
+    // compute base58, least significant digits first
     i = 0;
+    top = 0;
     do {
-        unsigned rem = 0, tmp;
-        num_is_non_zero = 0;
+        b58_acc_t rem = 0;
+
+        for (j = top; j < nlimbs; j++) {
+            b58_acc_t tmp = rem << (8 * LIMB_BYTES) | num[j];
+            num[j] = tmp / LIMB_RADIX;
+            rem = tmp % LIMB_RADIX;
+        }
+        while (top < nlimbs && !num[top])
+            top++;
 
-        for (j = 0; j < len; j++) {
-            tmp = rem * 24 + num[j];    // 2^8 == 4*58 + 24
-            num_is_non_zero |= num[j] = rem * 4 + tmp / 58;
-            rem = tmp % 58;
+        // in the last pass, stop at the most significant non-zero digit
+        for (j = 0; j < LIMB_DIGITS; j++) {
+            b58_buf[i++] = base58_map[rem % 58];
+            rem /= 58;
+            if (top == nlimbs && !rem)
+                break;
         }
-        b58_buf[i++] = base58_map[rem];
-    } while (num_is_non_zero);
+    } while (top < nlimbs);
 
     // add '1' for each leading 0 in data
-    while (!*data++)
+    for (j = 0; j < len && !data[j]; j++)
         b58_buf[i++] = '1';
     b58_buf[i--] = 0;
 
@@ -111,19 +147,17 @@ void base58_encode_address(const curve_point *pub, unsigned char avb,
     } to_encode;
 
     uint8_t keybytes[1 + 64];
-    uint32_t hash_tmp[SHA256_SIZE / 4];
 
     // serialise public key and compute its hash
     bn_write_be(&pub->x, keybytes + 1);
     if (compressed) {
         keybytes[0] = 2 + (pub->y.val[0] & 1);
-        sha256_hash(hash_tmp, keybytes, 1 + 32);
+        hash160_33(to_encode.hash, keybytes);
     } else {
         keybytes[0] = 4;
         bn_write_be(&pub->y, keybytes + 1 + 32);
-        sha256_hash(hash_tmp, keybytes, 1 + 64);
+        hash160_65(to_encode.hash, keybytes);
     }
-    ripemd160_hash(to_encode.hash, (uint8_t *)hash_tmp, sizeof hash_tmp);
 
     // add prefix
     to_encode.address[0] = avb;
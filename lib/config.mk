@@ -20,11 +20,13 @@ PART = sam4lc4c
 # List of C source files.
 CSRCS = \
 	assert.c \
+	base58dec.c \
 	base58enc.c \
 	bignum.c \
 	debug.c \
 	ecdsa.c \
 	fwsign.c \
+	hash160.c \
 	hex.c \
 	pbkdf2.c \
 	printf.c \
@@ -0,0 +1,79 @@
+/*
+ * HASH160 of serialised public keys.
+ *
+ * The messages have fixed length, so the padded SHA-256 blocks are built
+ * directly from the key, and the SHA-256 state is fed to RIPEMD-160 as its
+ * only block without going through a byte buffer.
+ *
+ * The author has waived all copyright and related or neighbouring rights
+ * to this file and placed it in public domain.
+ */
+
+#include <string.h>
+#include "endian.h"
+#include "sha256.h"
+#include "ripemd.h"
+#include "hash160.h"
+
+// Finish SHA-256 with the given state and compute RIPEMD-160 of the digest.
+static void ripemd160_of_sha256(uint32_t hash[5], const uint32_t state[8])
+{
+    uint32_t block[16];
+    int i;
+
+    // Digest bytes are big endian words of the state; RIPEMD-160 reads
+    // its input as little endian words.
+    for (i = 0; i < 8; i++)
+        block[i] = cpu_to_be32(state[i]);
+    block[8] = cpu_to_le32(0x80);
+    for (i = 9; i < 14; i++)
+        block[i] = 0;
+    block[14] = cpu_to_le32(SHA256_SIZE * 8);   // bit length
+    block[15] = 0;
+
+    ripemd160_init(hash);
+    ripemd160_transform(hash, block);
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+    for (i = 0; i < 5; i++)
+        hash[i] = cpu_to_le32(hash[i]);
+#endif
+}
+
+void hash160_33(uint32_t hash[5], const uint8_t *pubkey)
+{
+    union {
+        uint8_t  b[SHA256_BLOCK_SIZE];
+        uint32_t w[SHA256_BLOCK_SIZE / 4];
+    } block;
+    uint32_t state[8];
+
+    memcpy(block.b, pubkey, 33);
+    block.b[33] = 0x80;
+    memset(block.b + 34, 0, 60 - 34);
+    block.w[15] = cpu_to_be32(33 * 8);          // bit length
+
+    sha256_init(state);
+    sha256_transform(state, block.w);
+    ripemd160_of_sha256(hash, state);
+}
+
+void hash160_65(uint32_t hash[5], const uint8_t *pubkey)
+{
+    union {
+        uint8_t  b[SHA256_BLOCK_SIZE];
+        uint32_t w[SHA256_BLOCK_SIZE / 4];
+    } block;
+    uint32_t state[8];
+
+    sha256_init(state);
+    memcpy(block.b, pubkey, 64);
+    sha256_transform(state, block.w);
+
+    block.b[0] = pubkey[64];
+    block.b[1] = 0x80;
+    memset(block.b + 2, 0, 60 - 2);
+    block.w[15] = cpu_to_be32(65 * 8);          // bit length
+    sha256_transform(state, block.w);
+    ripemd160_of_sha256(hash, state);
+}
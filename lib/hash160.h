@@ -0,0 +1,14 @@
+// HASH160: RIPEMD-160 of SHA-256, as used for Bitcoin addresses.
+// Public domain.
+
+#ifndef HASH160_H
+#define HASH160_H
+
+#include <stdint.h>
+
+// Hash a serialised public key: compressed (33 bytes) or uncompressed (65).
+// The result is a byte sequence, like that of ripemd160_hash().
+void hash160_33(uint32_t hash[5], const uint8_t *pubkey);
+void hash160_65(uint32_t hash[5], const uint8_t *pubkey);
+
+#endif
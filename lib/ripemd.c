@@ -12,7 +12,7 @@
 #include "ripemd.h"
 
 
-static void ripemd160_init(uint32_t state[5])
+void ripemd160_init(uint32_t state[5])
 {
     static const uint32_t init_value[] = {
         0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
@@ -97,7 +97,7 @@ static void Subround(
     *c = rotlFixed((uint32_t)*c, 10U);
 }
 
-static void ripemd160_transform(uint32_t digest[5], const uint32_t Y[16])
+void ripemd160_transform(uint32_t digest[5], const uint32_t Y[16])
 {
     int i;
     uint32_t X[16];
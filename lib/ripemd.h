@@ -12,4 +12,9 @@ enum {
 
 void ripemd160_hash(uint32_t hash[5], const uint8_t *data, int len);
 
+// Interface for processing the message in 64-byte blocks.
+// State is in native byte order, data is little endian.
+void ripemd160_init(uint32_t state[5]);
+void ripemd160_transform(uint32_t state[5], const uint32_t data[16]);
+
 #endif
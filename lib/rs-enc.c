@@ -2,7 +2,7 @@
  * 8-bit Reed-Solomon encoder.
  * Includes support for Galois Field GF(2^8) maths.
  *
- * Copyright 2013-2014 Mycelium SA, Luxembourg.
+ * Copyright 2013-2015 Mycelium SA, Luxembourg.
  *
  * This file is part of Mycelium Entropy.
  *
@@ -22,85 +22,170 @@
 #include <assert.h>
 #include "rs.h"
 
-struct RS_state rs;
-
-// logarithmic multiplication
-// assumes b != INFTY, as is the case here
-static unsigned logmul(unsigned a, unsigned b)
+// Logarithms base 2 (aka α) in GF(2^8); log(0) is INFTY, standing for -∞.
+const uint8_t gf_log[256] = {
+    255,  0,  1, 25,  2, 50, 26,198,  3,223, 51,238, 27,104,199, 75,
+      4,100,224, 14, 52,141,239,129, 28,193,105,248,200,  8, 76,113,
+      5,138,101, 47,225, 36, 15, 33, 53,147,142,218,240, 18,130, 69,
+     29,181,194,125,106, 39,249,185,201,154,  9,120, 77,228,114,166,
+      6,191,139, 98,102,221, 48,253,226,152, 37,179, 16,145, 34,136,
+     54,208,148,206,143,150,219,189,241,210, 19, 92,131, 56, 70, 64,
+     30, 66,182,163,195, 72,126,110,107, 58, 40, 84,250,133,186, 61,
+    202, 94,155,159, 10, 21,121, 43, 78,212,229,172,115,243,167, 87,
+      7,112,192,247,140,128, 99, 13,103, 74,222,237, 49,197,254, 24,
+    227,165,153,119, 38,184,180,124, 17, 68,146,217, 35, 32,137, 46,
+     55, 63,209, 91,149,188,207,205,144,135,151,178,220,252,190, 97,
+    242, 86,211,171, 20, 42, 93,158,132, 60, 57, 83, 71,109, 65,162,
+     31, 45, 67,216,183,123,164,118,196, 23, 73,236,127, 12,111,246,
+    108,161, 59, 82, 41,157, 85,170,251, 96,134,177,187,204, 62, 90,
+    203, 89, 95,176,156,169,160, 81, 11,245, 22,235,122,117, 44,215,
+     79,174,213,233,230,231,173,232,116,214,244,234,168, 80, 88,175,
+};
+
+// Powers of 2 aka α in GF(2^8); exp(INFTY) is 0.
+const uint8_t gf_exp[256] = {
+      1,  2,  4,  8, 16, 32, 64,128, 29, 58,116,232,205,135, 19, 38,
+     76,152, 45, 90,180,117,234,201,143,  3,  6, 12, 24, 48, 96,192,
+    157, 39, 78,156, 37, 74,148, 53,106,212,181,119,238,193,159, 35,
+     70,140,  5, 10, 20, 40, 80,160, 93,186,105,210,185,111,222,161,
+     95,190, 97,194,153, 47, 94,188,101,202,137, 15, 30, 60,120,240,
+    253,231,211,187,107,214,177,127,254,225,223,163, 91,182,113,226,
+    217,175, 67,134, 17, 34, 68,136, 13, 26, 52,104,208,189,103,206,
+    129, 31, 62,124,248,237,199,147, 59,118,236,197,151, 51,102,204,
+    133, 23, 46, 92,184,109,218,169, 79,158, 33, 66,132, 21, 42, 84,
+    168, 77,154, 41, 82,164, 85,170, 73,146, 57,114,228,213,183,115,
+    230,209,191, 99,198,145, 63,126,252,229,215,179,123,246,241,255,
+    227,219,171, 75,150, 49, 98,196,149, 55,110,220,165, 87,174, 65,
+    130, 25, 50,100,200,141,  7, 14, 28, 56,112,224,221,167, 83,166,
+     81,162, 89,178,121,242,249,239,195,155, 43, 86,172, 69,138,  9,
+     18, 36, 72,144, 61,122,244,245,247,243,251,235,203,139, 11, 22,
+     44, 88,176,125,250,233,207,131, 27, 54,108,216,173, 71,142,  0,
+};
+
+// RS code generator polynomials of degree 1 to RS_MAX_DEGREE.
+// The roots of the polynomial of degree n are the powers of 2 from 0 to n-1,
+// so it's a product of (x ^ 2**i), 0 ≤ i ≤ n-1.  Each polynomial is stored
+// as the logarithms of its coefficients, from x**0 up to x**n, and starts at
+// offset RS_GENERATOR(n).
+static const uint8_t rs_generator[] = {
+    // degree 1
+    0, 0,
+    // degree 2
+    1, 25, 0,
+    // degree 3
+    3, 199, 198, 0,
+    // degree 4
+    6, 78, 249, 75, 0,
+    // degree 5
+    10, 119, 166, 164, 113, 0,
+    // degree 6
+    15, 176, 5, 134, 0, 166, 0,
+    // degree 7
+    21, 102, 238, 149, 146, 229, 87, 0,
+    // degree 8
+    28, 196, 252, 215, 249, 208, 238, 175, 0,
+    // degree 9
+    36, 123, 11, 149, 235, 231, 137, 246, 95, 0,
+    // degree 10
+    45, 32, 94, 64, 70, 118, 61, 46, 67, 251, 0,
+    // degree 11
+    55, 10, 227, 116, 209, 177, 172, 194, 91, 192, 220, 0,
+    // degree 12
+    66, 157, 87, 131, 143, 198, 113, 187, 121, 98, 43, 102, 0,
+    // degree 13
+    78, 140, 206, 218, 130, 104, 106, 100, 86, 100, 176, 152, 74, 0,
+    // degree 14
+    91, 22, 59, 207, 87, 216, 137, 218, 124, 190, 48, 155, 249, 199, 0,
+    // degree 15
+    105, 99, 5, 124, 140, 237, 58, 58, 51, 37, 202, 91, 61, 183, 8, 0,
+    // degree 16
+    120, 225, 194, 182, 169, 147, 191, 91, 3, 76, 161, 102, 109, 107, 104,
+    120, 0,
+    // degree 17
+    136, 163, 243, 39, 150, 99, 24, 147, 214, 206, 123, 239, 43, 78, 206, 139,
+    43, 0,
+    // degree 18
+    153, 96, 98, 5, 179, 252, 148, 152, 187, 79, 170, 118, 97, 184, 94, 158,
+    234, 215, 0,
+    // degree 19
+    171, 220, 138, 222, 252, 133, 153, 128, 44, 159, 150, 17, 83, 90, 52, 153,
+    105, 3, 67, 0,
+    // degree 20
+    190, 188, 212, 212, 164, 156, 239, 83, 225, 221, 180, 202, 187, 26, 163,
+    61, 50, 79, 60, 17, 0,
+    // degree 21
+    210, 175, 148, 254, 122, 36, 230, 137, 148, 115, 210, 200, 85, 98, 67,
+    140, 181, 247, 104, 233, 240, 0,
+    // degree 22
+    231, 165, 105, 160, 134, 219, 80, 98, 172, 8, 74, 200, 53, 221, 109, 14,
+    230, 93, 242, 247, 171, 210, 0,
+    // degree 23
+    253, 147, 56, 78, 1, 192, 224, 164, 94, 248, 183, 25, 14, 150, 193, 17,
+    65, 103, 49, 91, 146, 102, 171, 0,
+    // degree 24
+    21, 227, 96, 87, 232, 117, 0, 111, 218, 228, 226, 192, 152, 169, 180, 159,
+    126, 251, 117, 211, 48, 135, 121, 229, 0,
+    // degree 25
+    45, 252, 178, 129, 243, 95, 182, 144, 167, 99, 208, 237, 66, 54, 201, 148,
+    15, 59, 12, 26, 170, 39, 156, 181, 231, 0,
+    // degree 26
+    70, 218, 145, 153, 227, 48, 102, 13, 142, 245, 21, 161, 53, 165, 28, 111,
+    201, 145, 17, 118, 182, 103, 2, 158, 125, 173, 0,
+    // degree 27
+    96, 149, 17, 26, 157, 193, 216, 94, 172, 126, 73, 135, 138, 58, 45, 99,
+    70, 237, 9, 29, 180, 21, 227, 165, 8, 228, 79, 0,
+    // degree 28
+    123, 9, 37, 242, 119, 212, 195, 42, 87, 245, 43, 21, 201, 232, 27, 205,
+    147, 195, 190, 110, 180, 108, 234, 224, 104, 200, 223, 168, 0,
+    // degree 29
+    151, 24, 140, 250, 68, 162, 202, 9, 23, 148, 150, 234, 75, 28, 189, 175,
+    241, 5, 136, 24, 249, 96, 54, 219, 151, 29, 183, 45, 156, 0,
+    // degree 30
+    180, 192, 40, 238, 216, 251, 37, 156, 130, 224, 193, 226, 173, 42, 125,
+    222, 96, 239, 86, 110, 48, 50, 182, 179, 31, 216, 152, 145, 173, 41, 0,
+    // degree 31
+    210, 200, 187, 117, 183, 123, 105, 225, 1, 55, 248, 248, 144, 119, 118,
+    137, 122, 73, 44, 39, 113, 83, 115, 31, 225, 75, 63, 93, 252, 37, 20, 0,
+};
+
+// Offset of the generator polynomial of degree n in rs_generator
+#define RS_GENERATOR(n) (((n) - 1) * ((n) + 2) / 2)
+
+void rs_init(struct RS_encoder *rs, unsigned degree)
 {
-    if (a == INFTY)
-        return INFTY;
-    a += b;
-    return a >= 255 ? a - 255 : a;      // modulo 255
-}
-
-// logarithmic addition
-static inline unsigned logadd(unsigned a, unsigned b)
-{
-    return rs.log[rs.exp[a] ^ rs.exp[b]];
-}
-
-void rs_init(unsigned gf_poly, unsigned degree)
-{
-    unsigned i, b;
-
-    assert(degree < sizeof (rs.poly));
-
-    rs.n = degree;
+    assert(degree >= 1 && degree <= RS_MAX_DEGREE);
 
-    // generate Galois field exp and log lookup tables
-    b = 1;
-    for (i = 0; i < 255; i++) {
-        // b = 2**i in GF
-        rs.log[b] = i;
-        rs.exp[i] = b;
-        b <<= 1;
-        if (b & 0x100)
-            b ^= gf_poly;
-    }
-    // special case: let log(0) be 255, representing -∞
-    rs.log[0] = INFTY;
-    rs.exp[INFTY] = 0;
-
-    // check if this polynomial really generates a GF
-    assert(b == 1);
-
-    // Calcluate RS code generator polynomial:
-    // its roots are powers of 2 from 0 to the specified degree,
-    // so it's a product of (x ^ 2**i), 0 ≤ i ≤ degree-1.
-    // The elements of poly are logarithms of coefficients.
-    rs.poly[0] = 0;
-    for (i = 0; i < degree; i++) {
-        unsigned j;
-
-        rs.poly[i+1] = 0;
-
-        // multiply poly by (x ^ 2**i), aka (x + 2**i) or (x - 2**i)
-        for (j = i; j > 0; --j)
-            rs.poly[j] = logadd(rs.poly[j-1], logmul(rs.poly[j], i));
-        rs.poly[0] = logmul(rs.poly[0], i);
-    }
+    rs->n = degree;
+    rs->poly = rs_generator + RS_GENERATOR(degree);
 }
 
-void rs_encode(const uint8_t *msg, int len, uint8_t *out)
+// The remainder of the division by the generator polynomial is computed
+// with a linear feedback shift register: each message byte is added to the
+// highest remainder byte, which then multiplies the generator and is
+// shifted out.  The generator has no zero coefficients.
+void rs_encode(const struct RS_encoder *rs, const uint8_t *msg, int len,
+               uint8_t *out)
 {
-    int i;
-    unsigned j;
-    uint8_t buf[len + rs.n];
+    const uint8_t *poly = rs->poly;
+    unsigned n = rs->n, j;
 
     assert(len > 0);
 
-    memcpy(buf, msg, len);
-    memset(buf + len, 0, rs.n);
+    memset(out, 0, n);
+
+    while (len--) {
+        unsigned coef = gf_log[*msg++ ^ out[0]];
 
-    for (i = 0; i < len; i++) {
-        unsigned coef = buf[i];
-        if (coef != 0) {
-            coef = rs.log[coef];
-            for (j = 1; j <= rs.n; j++)
-                buf[i+j] ^= rs.exp[logmul(rs.poly[rs.n - j], coef)];
+        if (coef == INFTY) {
+            memmove(out, out + 1, n - 1);
+            out[n - 1] = 0;
+            continue;
         }
+        for (j = 0; j < n - 1; j++) {
+            unsigned c = poly[n - 1 - j] + coef;
+            out[j] = out[j + 1] ^ gf_exp[c >= 255 ? c - 255 : c];
+        }
+        coef += poly[0];
+        out[n - 1] = gf_exp[coef >= 255 ? coef - 255 : coef];
     }
-
-    memcpy(out, buf + len, rs.n);
 }
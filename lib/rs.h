@@ -2,7 +2,7 @@
  * 8-bit Reed-Solomon encoder.
  * Includes support for Galois Field GF(2^8) maths.
  *
- * Copyright 2013-2014 Mycelium SA, Luxembourg.
+ * Copyright 2013-2015 Mycelium SA, Luxembourg.
  *
  * This file is part of Mycelium Entropy.
  *
@@ -25,27 +25,23 @@ enum {
     INFTY = 255,
 };
 
+// Galois Field GF(2^8) generated by x^8 + x^4 + x^3 + x^2 + 1 (0x11d), as
+// used by QR codes and Shamir's secret sharing.  The tables are constant.
+extern const uint8_t gf_log[256];   // logarithms base 2 (aka α), log(0) = INFTY
+extern const uint8_t gf_exp[256];   // powers of 2 aka α, exp(INFTY) = 0
+
+// Encoder context.  Any number of encoders may be used at the same time.
+struct RS_encoder {
+    unsigned n;             // degree of RS generator polynomial
+    const uint8_t *poly;    // its coefficients as logarithms, from x**0
+};
+
 // Initialise encoder.
 // The degree of the RS polynomial equals to the number of error correction
 // bytes.
 // Maximum allowed degree is 31, which is enough for QR codes.
-void rs_init(unsigned gf_poly, unsigned degree);
-
-// Write degree bytes of error correction information for msg into out.
-// As long as gf_poly and degree don't change, rs_encode may be called without
-// intermediate calls to rs_init.
-void rs_encode(const uint8_t *msg, int len, uint8_t *out);
-
-// These functions hold parameters in a global structure.
-// Should we need a re-entrant version, they are very easy to modify so as to
-// let the caller allocate the structure and pass a pointer to it to both
-// functions.
-
-struct RS_state {
-    unsigned n;         // degree of RS generator polynomial
-    uint8_t  log[256];  // logarithms base 2 (aka α)
-    uint8_t  exp[256];  // powers of 2 aka α
-    uint8_t  poly[32];  // enough for QR codes
-};
+void rs_init(struct RS_encoder *rs, unsigned degree);
 
-extern struct RS_state rs;
+// Write rs->n bytes of error correction information for msg into out.
+void rs_encode(const struct RS_encoder *rs, const uint8_t *msg, int len,
+               uint8_t *out);
@@ -17,20 +17,21 @@
  * GNU General Public License for more details.
  */
 
-#include "sss.h"
 #include "layout.h"
 #include "data.h"
 #include "settings.h"
 
 static char address[112];               // regular address or xpub
-static char sss[3][SSS_STRING_SIZE];    // 3*SSS, 1*WIF or 1*mnemonic
+static char privkey[112];               // WIF, mnemonic or one SSS share
+static char sss_label[16];              // "share x/n"
+static char sss_threshold[24];          // "any m shares reveal"
 static char unsalted[73];
 
 char * const texts[] = {
     [IDX_ADDRESS]       = address,
-    [IDX_SSS_PART(1)]   = sss[0],
-    [IDX_SSS_PART(2)]   = sss[1],
-    [IDX_SSS_PART(3)]   = sss[2],
+    [IDX_PRIVKEY]       = privkey,
+    [IDX_SSS_LABEL]     = sss_label,
+    [IDX_SSS_THRESHOLD] = sss_threshold,
     [IDX_UNSALTED]      = unsalted + 1,
     [IDX_HD_PATH]       = settings.hd_path,
 };
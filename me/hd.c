@@ -24,7 +24,7 @@
 #include "lib/sha256.h"
 #include "lib/sha512.h"
 #include "lib/pbkdf2.h"
-#include "lib/ripemd.h"
+#include "lib/hash160.h"
 #include "lib/base58.h"
 #include "lib/ecdsa.h"
 #include "settings.h"
@@ -165,7 +165,6 @@ bool hd_make_xpub(const uint8_t *seed, int len)
             uint8_t  key_prefix;    // 2 or 3
             uint8_t  x[32];         // public key's x
         } xpub;
-        uint32_t aux[8];            // auxiliary buffer for SHA-256
     } node;
     bignum256 priv;                 // current node's private key
     bignum256 add;                  // additional material from HMAC
@@ -266,8 +265,7 @@ bool hd_make_xpub(const uint8_t *seed, int len)
             buf.first_byte = 0x02 | (pub.y.val[0] & 1);
             bn_write_be(&pub.x, buf.parent);
         }
-        sha256_hash(node.aux, &buf.first_byte, 33);
-        ripemd160_hash(buf.aux, (uint8_t *) node.aux, SHA256_SIZE);
+        hash160_33(buf.aux, &buf.first_byte);
         node.xpub.fingerprint = buf.aux[0];
     }
 
@@ -0,0 +1,70 @@
+/*
+ * Continuous health tests on raw entropy samples.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "health.h"
+
+
+bool health_sample(struct Health_test *t, uint32_t sample)
+{
+    bool ok = true;
+
+    // Repetition Count Test (SP 800-90B, 4.4.1): fail if the same value
+    // appears rct_cutoff times in a row.
+    if (t->rct_count && sample == t->rct_value) {
+        if (++t->rct_count >= t->rct_cutoff) {
+            t->rct_failures++;
+            t->rct_count = 0;
+            ok = false;
+        }
+    } else {
+        t->rct_value = sample;
+        t->rct_count = 1;
+    }
+
+    // Adaptive Proportion Test (SP 800-90B, 4.4.2): fail if the first value
+    // in a window of HEALTH_WINDOW samples occurs apt_cutoff times in it.
+    if (t->apt_index == 0) {
+        t->apt_value = sample;
+        t->apt_count = 1;
+    } else if (sample == t->apt_value && ++t->apt_count >= t->apt_cutoff) {
+        t->apt_failures++;
+        t->apt_index = 0;
+        return false;
+    }
+    if (++t->apt_index == HEALTH_WINDOW)
+        t->apt_index = 0;
+
+    return ok;
+}
+
+bool health_words(struct Health_test *t, const uint32_t *words, unsigned n)
+{
+    bool ok = true;
+    while (n--)
+        ok &= health_sample(t, *words++);
+    return ok;
+}
+
+bool health_bytes(struct Health_test *t, const uint8_t *bytes, unsigned n)
+{
+    bool ok = true;
+    while (n--)
+        ok &= health_sample(t, *bytes++);
+    return ok;
+}
@@ -0,0 +1,68 @@
+/*
+ * Continuous health tests on raw entropy samples.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef HEALTH_H_INCLUDED
+#define HEALTH_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Cutoff values for the Repetition Count and Adaptive Proportion tests
+// from NIST SP 800-90B, section 4.4.  They are computed for the false
+// positive probability alpha = 2**-30 and the claimed min-entropy H per
+// sample:
+//  RCT cutoff = 1 + ceil(30 / H)
+//  APT cutoff = 1 + CRITBINOM(HEALTH_WINDOW, 2**-H, 1 - alpha)
+// TRNG words are assumed to carry at least 16 bits of entropy out of 32.
+// The least significant byte of the ADC noise is assumed to carry at least
+// 1 bit.  Both are conservative; a false positive halts the device.
+enum {
+    HEALTH_WINDOW       = 512,      // APT window for non-binary samples
+
+    TRNG_RCT_CUTOFF     = 3,        // H = 16
+    TRNG_APT_CUTOFF     = 4,
+    ADC_RCT_CUTOFF      = 31,       // H = 1
+    ADC_APT_CUTOFF      = 325,
+};
+
+// State of the tests for one noise source.
+// Windows and repetition runs span successive calls, so the samples can be
+// fed in as they arrive, in chunks of any size.
+struct Health_test {
+    uint32_t rct_value;         // last sample
+    uint32_t apt_value;         // first sample in the current window
+    uint16_t rct_count;         // number of times rct_value has been repeated
+    uint16_t apt_count;         // occurrences of apt_value in the window
+    uint16_t apt_index;         // position in the window
+    uint16_t rct_cutoff;
+    uint16_t apt_cutoff;
+    uint16_t rct_failures;      // failure counters for diagnostics
+    uint16_t apt_failures;
+};
+
+#define HEALTH_TEST(rct, apt)   { .rct_cutoff = (rct), .apt_cutoff = (apt) }
+
+// Feed a sample or a block of samples into the tests.
+// Return false if any of the tests fails.  The tests are restarted after
+// failure, so that the caller may carry on counting.
+bool health_sample(struct Health_test *t, uint32_t sample);
+bool health_words(struct Health_test *t, const uint32_t *words, unsigned n);
+bool health_bytes(struct Health_test *t, const uint8_t *bytes, unsigned n);
+
+#endif
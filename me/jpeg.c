@@ -24,6 +24,7 @@
 #include <assert.h>
 #include <ff.h>
 
+#include "lib/endian.h"
 #include "qr.h"
 #include "xflash.h"
 #include "jpeg.h"
@@ -67,7 +68,7 @@ struct pic_state {
 // QR codes have no static bodies.  They are generated dynamically directly
 // into their state.
 struct qr_state {
-    uint8_t  size;          // QR code size in modules (29 or 33)
+    uint8_t  size;          // QR code size in modules (29 to 57)
     uint8_t  idx;           // index of the text to render (address, key, etc.)
     uint16_t row;           // index of the next row of modules/macroblocks
     qr_row_t qr[QR_SIZE(QR_MAX_VERSION)];   // bit map
@@ -93,64 +94,152 @@ union fgm_state {
 struct fgm_ctl {
     struct fgm_ctl *next;   // chain of active fragments for the current row
     unsigned x;             // start of this fragment in macroblocks
+    unsigned type;          // FGM_PICTURE, FGM_QR or FGM_TEXT
     bool (*render)(union fgm_state *state, int total_width);
     union fgm_state state[0];
 };
 
-// Checkpoint (not implemented yet)
-struct checkpoint {
-    uint16_t y;     // macroblock row
-    // TODO
-};
+// Maximum number of fragments active at the same time
+#define MAX_FRAGMENTS   8
 
-// Pool of fragment states
-static struct {
-    struct fgm_ctl ctl;
-    struct pic_state state;
-} pic_fragments[4];
+// Size of a fragment control structure with its state
+#define FGM_SIZE(state_type) ((sizeof (struct fgm_ctl) + sizeof (state_type) \
+        + __alignof__ (struct fgm_ctl) - 1) & -__alignof__ (struct fgm_ctl))
 
-static struct {
-    struct fgm_ctl ctl;
-    struct qr_state state;
-} qr_fragments[2];
+static const uint16_t fgm_size[FGM_STOP] = {
+    [FGM_PICTURE]   = FGM_SIZE(struct pic_state),
+    [FGM_QR]        = FGM_SIZE(struct qr_state),
+    [FGM_TEXT]      = FGM_SIZE(struct text_state),
+};
 
+// Fragment states are allocated from an arena at the end of the stream
+// buffer, sized in jpeg_init() for the peak number of fragments of each type
+// in the layout.  Freed fragments go to a free list for their type, so each
+// type never uses more than its share of the arena.
 static struct {
-    struct fgm_ctl ctl;
-    struct text_state state;
-} text_fragments[2];
+    uint8_t *start;
+    uint8_t *ptr;           // next unallocated byte
+    uint8_t *end;
+    struct fgm_ctl *free[FGM_STOP];
+} arena;
 
-// Allocate fragment state
-static struct fgm_ctl * alloc(void *pool, size_t element_size, size_t pool_size)
+static void arena_reset(void)
 {
-    void *end = (uint8_t*) pool + pool_size;
-    ((void) end);
+    arena.ptr = arena.start;
+    memset(arena.free, 0, sizeof arena.free);
+}
 
-    while (((struct fgm_ctl *)pool)->next) {
-        pool = (uint8_t*) pool + element_size;
-        assert(pool < end);
+// Allocate fragment state
+static struct fgm_ctl * alloc(unsigned type)
+{
+    struct fgm_ctl *fgm = arena.free[type];
+
+    if (fgm) {
+        arena.free[type] = fgm->next;
+    } else {
+        fgm = (struct fgm_ctl *) arena.ptr;
+        arena.ptr += fgm_size[type];
+        assert(arena.ptr <= arena.end);
     }
+    fgm->type = type;
 
-    return pool;
+    return fgm;
 }
 
-#define ALLOC(pool) alloc(pool, sizeof (pool[0]), sizeof pool)
-
 static inline void dealloc(struct fgm_ctl *fgm)
 {
-    fgm->next = 0;
+    fgm->next = arena.free[fgm->type];
+    arena.free[fgm->type] = fgm;
 }
 
+// Checkpoint of the generator state between two calls to jpeg_more().
+// QR bit maps are not saved, because they can be encoded again.
+struct checkpoint {
+    uint32_t pos;                   // position in the output file
+    const struct Layout_cmd *cmd;   // next layout command
+    uint16_t y;                     // macroblock rows output so far
+    uint16_t row_base;              // first row of the current page
+    uint8_t  page;                  // current page, from 1
+    uint32_t leftover_bits;         // bit writer state
+    uint8_t  num_leftover_bits;
+    uint8_t  num_fgm;               // number of active fragments
+    struct {
+        uint8_t type;               // FGM_PICTURE, FGM_QR or FGM_TEXT
+        uint8_t x;
+        union {
+            struct pic_state  pic;
+            struct text_state text;
+            struct {                // beginning of struct qr_state
+                uint8_t  size;
+                uint8_t  idx;
+                uint16_t row;
+            } qr;
+        };
+    } fgm[MAX_FRAGMENTS];
+};
+
+#define BLKSIZE 512
+
+// Checkpoints are taken every checkpoint_interval blocks of output.
+// When the ring is full, every other checkpoint is dropped and the interval
+// is doubled, so that the whole image remains covered.
+enum {
+    CHECKPOINTS         = 4,
+    CHECKPOINT_INTERVAL = 16,       // initial interval in blocks
+};
+static struct checkpoint checkpoints[CHECKPOINTS];    // in order of pos
+static unsigned num_checkpoints;
+static unsigned checkpoint_interval;
+
+// Read-ahead.  Blocks are generated on demand, plus up to read_ahead.blocks
+// beyond the one requested.  After a request that continues the previous one,
+// this is set to the length of two such requests, capped by the watermark;
+// after a random access, nothing is generated ahead.  Up to KEEP_BEHIND
+// blocks before the requested one are retained for repeated reads.  Each of
+// them adds to the minimum size of the stream buffer below.  A stream that
+// is read only once, in order, keeps none.
+enum {
+    KEEP_BEHIND         = 2,
+};
+static unsigned keep_behind = KEEP_BEHIND;
+
+// Maximum size of data that a single call to jpeg_more can generate.  This is
+// usually the maximum size (in bytes) of one macroblock row and determined
+// empirically.  The stream buffer must hold twice that, plus the blocks kept
+// behind the requested one, the requested one and a partial one, so that
+// jpeg_fill() can always make progress.  When none are kept behind, the
+// buffer can also wrap whenever the partial block is the only one left, and
+// it only has to hold that much once.
+enum {
+    RESERVE             = 10 * 1024,
+    MIN_STREAM_SIZE     = 2 * RESERVE + (KEEP_BEHIND + 2) * BLKSIZE,
+    MIN_SEQUENTIAL_SIZE = RESERVE + 2 * BLKSIZE,
+};
+static struct {
+    unsigned next;                  // block following the last request
+    unsigned blocks;                // blocks to generate ahead
+    unsigned watermark;             // maximum of blocks, 0 for no limit
+} read_ahead;
+
+struct Jpeg_stats jpeg_stats;
+
 // JPEG file markers
 enum {
     SOF0_BASELINE_DCT   = 0xC0, // start of frame: baseline DCT
     DHT                 = 0xC4, // define Huffman table(s)
+    RST0                = 0xD0, // restart marker 0 (to RST7 = 0xD7)
     SOI                 = 0xD8, // start of image
     EOI                 = 0xD9, // end of image
     SOS                 = 0xDA, // start of scan
     DQT                 = 0xDB, // define quantisation table(s)
+    DRI                 = 0xDD, // define restart interval
     APP0_JFIF           = 0xE0, // application segment: JFIF
 };
 
+enum {
+    SOS_SIZE    = 10,   // size of the SOS segment for one component
+};
+
 enum {
     UNITS_DPI   = 1,    // densities in dots per inch
     UNITS_DPCM  = 2,    // densities in dots per cm
@@ -168,71 +257,244 @@ static const struct {
     SME,    // 1->1: same
 };
 
+// Encodings of QR_WINDOW modules at a time, indexed by the modules
+// (LSbit first) shifted left by one, and the preceding module in bit 0.
+// Built by jpeg_init() from jpeg_encoding.  An entry can be longer than 32
+// bits, so it is split in two parts, the first of which is usually empty.
+enum {
+    QR_WINDOW = 4,      // modules per table entry
+};
+static struct {
+    uint32_t hi, lo;        // first hi_len bits, then lo_len bits
+    uint8_t  hi_len, lo_len;
+} qr_encoding[2 << QR_WINDOW];
+
 static struct {
     uint8_t *buf;
-    unsigned leftover_bits;
+    unsigned leftover_bits;     // pending bits (fewer than 32)
     unsigned num_leftover_bits;
 } jpeg;
 
+// Bit writer.  Renderers load the stream state into a local struct bits,
+// which the compiler can keep in registers, and store it back when done.
+// Bits are accumulated in a 64-bit word and output 32 bits at a time,
+// with a 0 stuffed after every 0xFF byte.
+struct bits {
+    uint64_t word;
+    unsigned len;           // number of pending bits in word
+    uint8_t *p;
+};
 
-static void copy_bitstream(const uint16_t *src, uint16_t nwords,
-                           uint16_t nbits, uint16_t bits, int gap)
+static inline void bits_load(struct bits *b)
 {
-    unsigned word = jpeg.leftover_bits;
-    unsigned len  = jpeg.num_leftover_bits;
-    uint8_t *p = jpeg.buf;
-
-    for (; nwords; --nwords) {
-        word = word << 16 | *src++;
-        *p++ = word >> (len+8);
-        if ((word >> (len+8) & 0xff) == 0xff)
-            *p++ = 0;   // stuffing
-        *p++ = word >> len;
-        if ((word >> len & 0xff) == 0xff)
-            *p++ = 0;   // stuffing
-    }
-
-    if (nbits) {
-        word = word << nbits | bits;
-        len += nbits;
-        while (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
-            if ((word >> len & 0xff) == 0xff)
-                *p++ = 0;   // stuffing
-        }
-    }
+    b->word = jpeg.leftover_bits;
+    b->len = jpeg.num_leftover_bits;
+    b->p = jpeg.buf;
+}
 
-    // add whitespace
-    for (; gap >= SME_LONG_MB; gap -= SME_LONG_MB) {
-        word = word << SME_LONG_LEN | SME_LONG_BITS;
-        len += SME_LONG_LEN;
-        while (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
+static inline void bits_store(const struct bits *b)
+{
+    jpeg.leftover_bits = b->word;
+    jpeg.num_leftover_bits = b->len;
+    jpeg.buf = b->p;
+}
+
+// Append n bits (n <= 32).  Bits above n must be 0.
+static inline void put_bits(struct bits *b, uint32_t bits, unsigned n)
+{
+    b->word = b->word << n | bits;
+    b->len += n;
+
+    if (b->len >= 32) {
+        b->len -= 32;
+        uint32_t w = b->word >> b->len;
+
+        // No byte of w is 0xFF iff no byte of ~w is 0.
+        if (((~w - 0x01010101) & w & 0x80808080) == 0) {
+            w = cpu_to_be32(w);
+            memcpy(b->p, &w, 4);
+            b->p += 4;
+        } else {
+            int i;
+            for (i = 24; i >= 0; i -= 8) {
+                *b->p++ = w >> i;
+                if ((w >> i & 0xff) == 0xff)
+                    *b->p++ = 0;    // stuffing
+            }
         }
     }
-    for (; gap; --gap) {
-        word = word << SME_LEN | SME_BITS;
-        len += SME_LEN;
-        if (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
-        }
+}
+
+// Pad the pending bits with ones to a byte boundary, and output them.
+static void flush_bits(struct bits *b)
+{
+    unsigned pad = -b->len & 7;
+
+    b->word = b->word << pad | ((1 << pad) - 1);
+    b->len += pad;
+    while (b->len) {
+        b->len -= 8;
+        *b->p = b->word >> b->len;
+        if (*b->p++ == 0xff)
+            *b->p++ = 0;    // stuffing
     }
+}
 
-    jpeg.leftover_bits = word;
-    jpeg.num_leftover_bits = len;
-    jpeg.buf = p;
+// Restart markers are output every restart_rows macroblock rows, if not 0.
+// Each restart interval is then a band of rows which can be decoded (and
+// encoded) on its own, since the DC prediction is reset at its start.
+static unsigned restart_rows;
+static unsigned y;                  // macroblock rows output so far
+
+// Pages of layouts with FGM_REPEAT.  Layout rows count from row_base.
+static unsigned pages = 1;          // number of pages
+static void (*new_page)(unsigned page);
+static unsigned page;               // current page, from 1
+static unsigned row_base;           // first row of the current page
+static const struct Layout_cmd *repeat;     // FGM_REPEAT command, if any
+static unsigned height;             // image height in macroblock rows
+
+// Start page p.
+static void start_page(unsigned p)
+{
+    page = p;
+    if (repeat && new_page)
+        new_page(p);
 }
 
+
+static void copy_bitstream(const uint16_t *src, uint16_t nwords,
+                           uint16_t nbits, uint16_t bits, int gap)
+{
+    struct bits b;
+
+    bits_load(&b);
+
+    for (; nwords >= 2; nwords -= 2, src += 2)
+        put_bits(&b, (uint32_t) src[0] << 16 | src[1], 32);
+    if (nwords)
+        put_bits(&b, *src, 16);
+    if (nbits)
+        put_bits(&b, bits, nbits);
+
+    // add whitespace
+    for (; gap >= SME_LONG_MB; gap -= SME_LONG_MB)
+        put_bits(&b, SME_LONG_BITS, SME_LONG_LEN);
+    for (; gap; --gap)
+        put_bits(&b, SME_BITS, SME_LEN);
+
+    bits_store(&b);
+}
 static inline void whitespace(int size_in_mb)
 {
     copy_bitstream(0, 0, 0, 0, size_in_mb);
 }
 
+// Called at the start of each macroblock row.  If the row starts a restart
+// interval, output the restart marker and return true: the first macroblock
+// of the row must then be coded against a DC prediction of 0 (grey) rather
+// than white.  The first row is treated the same way, without a marker.
+static bool band_start(void)
+{
+    if (y == 0)
+        return true;
+    if (!restart_rows || y % restart_rows)
+        return false;
+
+    struct bits b;
+
+    bits_load(&b);
+    flush_bits(&b);
+    *b.p++ = 0xFF;
+    *b.p++ = RST0 + ((y / restart_rows - 1) & 7);
+    bits_store(&b);
+
+    return true;
+}
+
+// Output n rows of white macroblocks.
+static void white_rows(unsigned n)
+{
+    while (n) {
+        unsigned k = n;
+
+        if (restart_rows && k > restart_rows - y % restart_rows)
+            k = restart_rows - y % restart_rows;
+
+        if (band_start())
+            copy_bitstream(0, 0, GTW_LEN, GTW_BITS, k * JWIDTH - 1);
+        else
+            whitespace(k * JWIDTH);
+
+        y += k;
+        n -= k;
+    }
+}
+
 #if USE_EXT_FLASH
 static FIL lay_file;
+
+// Cache of the layout file in aligned blocks.  Each active picture fragment
+// reads its bitstream sequentially, so with a block for each of up to four
+// picture fragments and one for large pictures, rows are mostly copied from
+// memory rather than through FatFs.  The least recently used block is replaced.
+enum {
+    LAY_BLOCK_SIZE  = 512,
+    LAY_BLOCKS      = 5,
+};
+static struct {
+    unsigned addr;          // file offset of the block, ~0 if empty
+    unsigned len;           // number of valid bytes
+    unsigned used;          // lay_clock at last use
+    uint16_t data[LAY_BLOCK_SIZE / 2];
+} lay_cache[LAY_BLOCKS];
+static unsigned lay_clock;
+
+static void lay_cache_init(void)
+{
+    int i;
+
+    for (i = 0; i < LAY_BLOCKS; i++) {
+        lay_cache[i].addr = ~0u;
+        lay_cache[i].used = 0;
+    }
+}
+
+// Return a pointer to the layout file data at addr, and through *len the
+// number of words available there.  Return 0 on error.
+static const uint16_t * lay_read(unsigned addr, unsigned *len)
+{
+    unsigned base = addr & -LAY_BLOCK_SIZE;
+    int i, victim = 0;
+
+    for (i = 0; i < LAY_BLOCKS; i++) {
+        if (lay_cache[i].addr == base)
+            break;
+        if (lay_cache[i].used < lay_cache[victim].used)
+            victim = i;
+    }
+
+    if (i == LAY_BLOCKS) {
+        UINT bytes_read;
+        i = victim;
+        lay_cache[i].addr = ~0u;
+        FRESULT res1 = f_lseek(&lay_file, base);
+        FRESULT res2 = f_read(&lay_file, lay_cache[i].data, LAY_BLOCK_SIZE,
+                &bytes_read);
+        if (res1 != FR_OK || res2 != FR_OK || bytes_read < addr - base + 2) {
+            printf("lseek and read: %d %d\n", res1, res2);
+            global_error_flags |= FLASH_ERROR;
+            return 0;
+        }
+        lay_cache[i].addr = base;
+        lay_cache[i].len = bytes_read;
+    }
+
+    lay_cache[i].used = ++lay_clock;
+    *len = (lay_cache[i].len - (addr - base)) / 2;
+    return lay_cache[i].data + (addr - base) / 2;
+}
+
 // copy bitstream from external serial flash
 static unsigned copy_bitstream_from_flash(
         unsigned addr,      // address of bitstream in serial flash
@@ -241,33 +503,36 @@ static unsigned copy_bitstream_from_flash(
         uint16_t bits,      // contents of leftover bits
         int gap)            // gap in macroblocks
 {
-    uint16_t buf[256];
-    unsigned len;
+    const uint16_t *src = 0;
+    unsigned len = 0;
 
-    do {
-        len = nwords < sizeof buf / 2 ? nwords : sizeof buf / 2;
-
-        if (len) {
-            UINT bytes_read;
-            FRESULT res1 = f_lseek(&lay_file, addr);
-            FRESULT res2 = f_read(&lay_file, buf, len * 2, &bytes_read);
-            if (res1 != FR_OK || res2 != FR_OK || bytes_read != len * 2) {
-                printf("lseek and read: %d %d\n", res1, res2);
-                global_error_flags |= FLASH_ERROR;
+    for (;;) {
+        if (nwords) {
+            src = lay_read(addr, &len);
+            if (!src)
                 return addr;
-            }
+            if (len > nwords)
+                len = nwords;
             addr += len * 2;
             nwords -= len;
         }
+        if (!nwords)
+            break;
+        copy_bitstream(src, len, 0, 0, 0);
+    }
 
-        if (nwords)
-            copy_bitstream(buf, len, 0, 0, 0);
-    } while (nwords);
-
-    copy_bitstream(buf, len, nbits, bits, gap);
+    copy_bitstream(src, len, nbits, bits, gap);
 
     return addr;
 }
+
+static uint16_t flash_word(unsigned addr)
+{
+    unsigned len;
+    const uint16_t *src = lay_read(addr, &len);
+
+    return src ? *src : 0;
+}
 #else
 // copy bitstream from the built-in flash
 extern const uint16_t jpeg_data_bin[];
@@ -281,6 +546,11 @@ static inline unsigned copy_bitstream_from_flash(
     copy_bitstream(jpeg_data_bin + addr / 2, nwords, nbits, bits, gap);
     return addr + nwords * 2;
 }
+
+static inline uint16_t flash_word(unsigned addr)
+{
+    return jpeg_data_bin[addr / 2];
+}
 #endif
 
 static bool render_pic(union fgm_state *state, int total_width)
@@ -303,35 +573,29 @@ static bool render_pic(union fgm_state *state, int total_width)
 static bool render_qr(union fgm_state *state, int total_width)
 {
     struct qr_state *st = &state->qr;
-    // stream buffer state
-    unsigned word = jpeg.leftover_bits;
-    unsigned len  = jpeg.num_leftover_bits;
-    uint8_t *p = jpeg.buf;
+    struct bits b;
+
+    bits_load(&b);
 
     // load the next row (LSbit first), adding the preceding 0
     qr_row_t line = st->qr[st->row] << 1;   // previous 0 bit
 
     // convert this row, adding margins up to total_width
-    do {
-        unsigned nbits = jpeg_encoding[line & 3].len;
-        word = word << nbits | jpeg_encoding[line & 3].bits;
-        len += nbits;
+    for (; total_width >= QR_WINDOW; total_width -= QR_WINDOW) {
+        unsigned i = line & ((2 << QR_WINDOW) - 1);
+        put_bits(&b, qr_encoding[i].hi, qr_encoding[i].hi_len);
+        put_bits(&b, qr_encoding[i].lo, qr_encoding[i].lo_len);
+        line >>= QR_WINDOW;
+    }
+    for (; total_width; total_width--) {
+        put_bits(&b, jpeg_encoding[line & 3].bits, jpeg_encoding[line & 3].len);
         line >>= 1;
-        while (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
-            if ((word >> len & 0xff) == 0xff)
-                *p++ = 0;   // stuffing
-        }
-    } while (--total_width);
+    }
 
-    jpeg.leftover_bits = word;
-    jpeg.num_leftover_bits = len;
-    jpeg.buf = p;
+    bits_store(&b);
 
     return ++st->row != st->size;
 }
-
 static inline int count_significant_bits(int x)
 {
 #ifdef __ARM_ARCH_7EM__
@@ -344,27 +608,162 @@ static inline int count_significant_bits(int x)
 #endif
 }
 
-static bool render_text(union fgm_state *state, int total_width)
+// Huffman tables from the DHT segments of jpeg_header, used to parse
+// precoded bitstreams.  Each table is 16 code counts followed by the symbols.
+static const uint8_t *dht_dc, *dht_ac;
+
+// Reader for precoded bitstreams
+static struct {
+    unsigned addr;          // address of the next word in flash
+    unsigned nwords;        // words left
+    unsigned word;          // current word
+    unsigned len;           // bits left in word
+    unsigned bits;          // leftover bits after the last word
+    unsigned nbits;
+} rd;
+
+static unsigned get_bit(void)
 {
-    struct text_state *st = &state->text;
-    // stream buffer state
-    unsigned word = jpeg.leftover_bits;
-    unsigned len  = jpeg.num_leftover_bits;
-    uint8_t *p = jpeg.buf;
+    if (!rd.len) {
+        if (rd.nwords) {
+            rd.word = flash_word(rd.addr);
+            rd.addr += 2;
+            rd.nwords--;
+            rd.len = 16;
+        } else {
+            assert(rd.nbits);
+            rd.word = rd.bits;
+            rd.len = rd.nbits;
+            rd.nbits = 0;
+        }
+    }
+    return rd.word >> --rd.len & 1;
+}
 
+// Read a Huffman code from the bitstream.  Return the symbol, and the code
+// and its length through *code and *len.
+static unsigned get_huffman(const uint8_t *table, unsigned *code, unsigned *len)
+{
+    const uint8_t *symbols = table + 16;
+    unsigned c = 0, first = 0;
+    int l;
+
+    for (l = 0; l < 16; l++) {
+        c |= get_bit();
+        if (c - first < table[l]) {
+            *code = c;
+            *len = l + 1;
+            return symbols[c - first];
+        }
+        symbols += table[l];
+        first = (first + table[l]) << 1;
+        c <<= 1;
+    }
+    assert(0);
+    return 0;
+}
+
+// Absolute DC value of white, as coded at the start of the image.
+static int white_dc(void)
+{
+    int cat = sizeof huff_dc / sizeof huff_dc[0] - 1;
+
+    for (; cat >= 0; cat--)
+        if (huff_dc[cat].len + cat + AC_EOB_LEN == GTW_LEN
+                && GTW_BITS >> (GTW_LEN - huff_dc[cat].len) == huff_dc[cat].code)
+            break;
+    assert(cat > 0);
+    return GTW_BITS >> AC_EOB_LEN & ((1 << cat) - 1);
+}
+
+// Copy a precoded bitstream of full macroblock rows, inserting restart
+// markers.  The first macroblock after each marker has its DC difference
+// recoded as an absolute value; everything else is copied as is.
+static void copy_rows_with_restarts(unsigned addr, unsigned height,
+        uint16_t nwords, uint16_t nbits, uint16_t bits)
+{
+    int dc = white_dc();    // DC prediction carried over from the last row
+    unsigned row, x;
+    struct bits b;
+
+    rd.addr = addr;
+    rd.nwords = nwords;
+    rd.len = 0;
+    rd.bits = bits;
+    rd.nbits = nbits;
+
+    for (row = 0; row < height; row++, y++) {
+        bool reset = band_start();
+
+        bits_load(&b);
+        for (x = 0; x < JWIDTH; x++) {
+            unsigned code, len, k;
+            unsigned cat = get_huffman(dht_dc, &code, &len);
+            int v = 0;
+
+            // DC difference
+            for (k = 0; k < cat; k++)
+                v = v << 1 | get_bit();
+            dc += cat && v < 1 << (cat - 1) ? v - (1 << cat) + 1 : v;
+            if (reset && x == 0) {
+                v = dc < 0 ? dc - 1 : dc;       // encoding rule
+                cat = count_significant_bits(v);
+                code = huff_dc[cat].code;
+                len = huff_dc[cat].len;
+            }
+            put_bits(&b, code, len);
+            put_bits(&b, v & ((1 << cat) - 1), cat);
+
+            // AC coefficients, copied as they are
+            for (k = 1; k < 64; ) {
+                unsigned rs = get_huffman(dht_ac, &code, &len);
+                put_bits(&b, code, len);
+                if (rs == 0)
+                    break;      // EOB
+                if (rs & 15) {
+                    unsigned i, extra = 0;
+                    for (i = 0; i < (rs & 15); i++)
+                        extra = extra << 1 | get_bit();
+                    put_bits(&b, extra, rs & 15);
+                }
+                k += (rs >> 4) + 1;
+            }
+        }
+        bits_store(&b);
+    }
+    assert(!rd.nwords && !rd.nbits && !rd.len);
+}
+
+// Return the number of characters at the start of text that fit on a line
+// of width characters.  Lines are broken at spaces.
+static int line_length(const char *text, int width)
+{
     int i;
-    int last_dc = 0;
 
-    for (i = 0; i < st->width && st->text[i]; i++) {
-        if (st->text[i] == ' ') {
+    for (i = 0; i < width && text[i]; i++) {
+        if (text[i] == ' ') {
             // check for line break
-            const char *next_space = index(st->text + i + 1, ' ');
+            const char *next_space = index(text + i + 1, ' ');
             if (!next_space)
-                next_space = index(st->text + i + 1, '\0');
-            if (next_space > st->text + st->width)
+                next_space = index(text + i + 1, '\0');
+            if (next_space > text + width)
                 break;          // Me name's Break.  Line Break.
         }
+    }
+    return i;
+}
+
+static bool render_text(union fgm_state *state, int total_width)
+{
+    struct text_state *st = &state->text;
+    struct bits b;
+
+    int i, n = line_length(st->text, st->width);
+    int last_dc = 0;
 
+    bits_load(&b);
+
+    for (i = 0; i < n; i++) {
         // character index in the font array
         unsigned chr_idx = font_map[st->text[i] - ' '];
         // this character's descriptor for this row
@@ -374,34 +773,19 @@ static bool render_text(union fgm_state *state, int total_width)
         int dc = chr.dc_in - last_dc;
         if (dc < 0) --dc;   // encoding rule
         int cat = count_significant_bits(dc);
-        word = word << huff_dc[cat].len | huff_dc[cat].code;
-        word = word << cat | (dc & ((1 << cat) - 1));
-        len += huff_dc[cat].len + cat;
-        while (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
-            if ((word >> len & 0xff) == 0xff)
-                *p++ = 0;   // stuffing
-        }
+        put_bits(&b, huff_dc[cat].code, huff_dc[cat].len);
+        put_bits(&b, dc & ((1 << cat) - 1), cat);
         last_dc = chr.dc_out;
 
         // copy rest of the character row
         const uint8_t *src = addr_font_data + chr.offset;
-        while (chr.nbytes) {
-            word = word << 8 | *src++;
-            *p++ = word >> len;
-            if ((word >> len & 0xff) == 0xff)
-                *p++ = 0;   // stuffing
-            --chr.nbytes;
-        }
-        word = word << chr.nbits | (*src & ((1 << chr.nbits) - 1));
-        len += chr.nbits;
-        if (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
-            if ((word >> len & 0xff) == 0xff)
-                *p++ = 0;   // stuffing
-        }
+        for (; chr.nbytes >= 4; chr.nbytes -= 4, src += 4)
+            put_bits(&b, (uint32_t) src[0] << 24 | src[1] << 16
+                    | src[2] << 8 | src[3], 32);
+        for (; chr.nbytes; chr.nbytes--)
+            put_bits(&b, *src++, 8);
+        if (chr.nbits)      // src may be at the end of the font data
+            put_bits(&b, *src & ((1 << chr.nbits) - 1), chr.nbits);
     }
 
     if (++st->row == CHR_HEIGHT) {
@@ -415,68 +799,36 @@ static bool render_text(union fgm_state *state, int total_width)
     int dc = -last_dc;
     if (dc < 0) --dc;   // encoding rule
     int cat = count_significant_bits(dc);
-    word = word << huff_dc[cat].len | huff_dc[cat].code;
-    word = word << cat | (dc & ((1 << cat) - 1));
-    // Check how much we can squeeze into word before it overflows:
-    //   max initial length:  7
-    //   max dc code length:  12
-    //   max dc value length: 11
-    //   total: 30
-    // We can safely add the AC EOB code if it is not longer than 2 bits.
-#if AC_EOB_LEN > 2
-#error This algorithm may cause word to overflow.
-#endif
-    word = word << AC_EOB_LEN | AC_EOB_CODE;
-    len += huff_dc[cat].len + cat + AC_EOB_LEN;
-    while (len >= 8) {
-        len -= 8;
-        *p++ = word >> len;
-        if ((word >> len & 0xff) == 0xff)
-            *p++ = 0;   // stuffing
-    }
+    put_bits(&b, huff_dc[cat].code, huff_dc[cat].len);
+    put_bits(&b, dc & ((1 << cat) - 1), cat);
+    put_bits(&b, AC_EOB_CODE, AC_EOB_LEN);
 
     // add whitespace
-    for (i = i * CHR_WIDTH + 1; i < total_width; i++) {
-        word = word << SME_LEN | SME_BITS;
-        len += SME_LEN;
-        if (len >= 8) {
-            len -= 8;
-            *p++ = word >> len;
-        }
-    }
+    for (i = i * CHR_WIDTH + 1; i < total_width; i++)
+        put_bits(&b, SME_BITS, SME_LEN);
 
-    jpeg.leftover_bits = word;
-    jpeg.num_leftover_bits = len;
-    jpeg.buf = p;
+    bits_store(&b);
 
     return *st->text;
 }
-
 static inline void finalise_jpeg(void)
 {
-    unsigned len = jpeg.num_leftover_bits;
-    uint8_t *p = jpeg.buf;
+    struct bits b;
 
-    if (len) {
-        // pad the last byte with ones
-        len = 8 - len;
-        unsigned word = ((jpeg.leftover_bits + 1) << len) - 1;
-        *p++ = word;
-    }
+    bits_load(&b);
+    flush_bits(&b);
 
     // add footer
-    *p++ = 0xFF;
-    *p++ = EOI;
+    *b.p++ = 0xFF;
+    *b.p++ = EOI;
 
-    jpeg.buf = p;
+    bits_store(&b);
 }
 
-#define BLKSIZE 512
-
-static unsigned dy;
 static struct fgm_ctl end = { .next = 0, .x = JWIDTH };
 static struct fgm_ctl *chain;
-static const struct Layout *layout;
+static struct Layout_cmd commands[LAYOUT_MAX_COMMANDS];
+static const struct Layout_cmd *cmd;    // next layout command
 
 struct {
     unsigned minblk;
@@ -485,9 +837,18 @@ struct {
     uint8_t *buf;
     uint8_t *end;
     unsigned endblk;
-    const struct Layout *layout;
+    unsigned size;          // size of the image in bytes, once known
+    bool minblk_partial;    // minblk is incomplete after resuming
 } stream;
 
+// Position of jpeg.buf in the output file.
+static unsigned stream_pos(void)
+{
+    return stream.minblk * BLKSIZE + (
+            jpeg.buf >= stream.minblk_ptr ? jpeg.buf - stream.minblk_ptr
+            : stream.tail - stream.minblk_ptr + (jpeg.buf - stream.buf));
+}
+
 #if DEBUG
 static void jpeg_dump(void)
 {
@@ -499,45 +860,366 @@ static void jpeg_dump(void)
 }
 #endif
 
-static void jpeg_fill(void);
+static void jpeg_fill(unsigned target);
+
+// Set the image height in the SOF segment of the JPEG header at p.
+static void set_height(uint8_t *p, unsigned rows)
+{
+    p += 2;     // skip SOI
+    while (p[1] != SOF0_BASELINE_DCT)
+        p += 2 + (p[2] << 8 | p[3]);
+    p[5] = rows * 8 >> 8;   // in pixels
+    p[6] = rows * 8;
+}
 
 static void jpeg_start(void)
 {
     uint8_t *buf = stream.buf;
 
     cbd_buf_owner = CBD_JPEG;
+    jpeg_stats.restarts++;
 
     stream.minblk = 0;
     stream.minblk_ptr = buf;
     stream.tail = buf;
     stream.endblk = 0;
+    stream.minblk_partial = false;
 
     chain = &end;
-    layout = stream.layout;
-    memcpy(buf, jpeg_header, sizeof jpeg_header);
+    cmd = commands;
+    row_base = 0;
+    start_page(1);
+    jpeg.buf = buf;
+
+    if (restart_rows) {
+        // insert DRI before the SOS segment, which ends the header
+        unsigned interval = restart_rows * JWIDTH;
+        unsigned sos = sizeof jpeg_header - SOS_SIZE;
+
+        memcpy(jpeg.buf, jpeg_header, sos);
+        jpeg.buf += sos;
+        *jpeg.buf++ = 0xFF;
+        *jpeg.buf++ = DRI;
+        *jpeg.buf++ = 0;
+        *jpeg.buf++ = 4;
+        *jpeg.buf++ = interval >> 8;
+        *jpeg.buf++ = interval;
+        memcpy(jpeg.buf, jpeg_header + sos, SOS_SIZE);
+        jpeg.buf += SOS_SIZE;
+    } else {
+        memcpy(jpeg.buf, jpeg_header, sizeof jpeg_header);
+        jpeg.buf += sizeof jpeg_header;
+    }
+    set_height(buf, height);
 
     // initialise bitstream output and change the background to white
-    jpeg.buf = buf + sizeof jpeg_header;
     jpeg.leftover_bits = 0;
     jpeg.num_leftover_bits = 0;
+    y = 0;
+
+    white_rows(1);
+    jpeg_stats.bytes += jpeg.buf - buf;
+
+    arena_reset();
+}
+
+// Save the generator state if the output has advanced far enough since
+// the last checkpoint.
+static void save_checkpoint(void)
+{
+    unsigned pos = stream_pos();
+    unsigned last = num_checkpoints ? checkpoints[num_checkpoints - 1].pos : 0;
+
+    if (pos < last + checkpoint_interval * BLKSIZE)
+        return;
+
+    if (num_checkpoints == CHECKPOINTS) {
+        unsigned i;
+        for (i = 1; i < CHECKPOINTS / 2; i++)
+            checkpoints[i] = checkpoints[2 * i];
+        num_checkpoints = CHECKPOINTS / 2;
+        checkpoint_interval *= 2;
+        if (pos < checkpoints[num_checkpoints - 1].pos
+                + checkpoint_interval * BLKSIZE)
+            return;
+    }
+
+    struct checkpoint *c = &checkpoints[num_checkpoints++];
+    struct fgm_ctl *fgm;
+    unsigned n = 0;
+
+    c->pos = pos;
+    c->cmd = cmd;
+    c->y = y;
+    c->row_base = row_base;
+    c->page = page;
+    c->leftover_bits = jpeg.leftover_bits;
+    c->num_leftover_bits = jpeg.num_leftover_bits;
+
+    for (fgm = chain; fgm != &end; fgm = fgm->next, n++) {
+        c->fgm[n].x = fgm->x;
+        if (fgm->render == render_pic) {
+            c->fgm[n].type = FGM_PICTURE;
+            c->fgm[n].pic = fgm->state->pic;
+        } else if (fgm->render == render_qr) {
+            c->fgm[n].type = FGM_QR;
+            c->fgm[n].qr.size = fgm->state->qr.size;
+            c->fgm[n].qr.idx = fgm->state->qr.idx;
+            c->fgm[n].qr.row = fgm->state->qr.row;
+        } else {
+            c->fgm[n].type = FGM_TEXT;
+            c->fgm[n].text = fgm->state->text;
+        }
+    }
+    c->num_fgm = n;
+}
+
+// Restart the generator from checkpoint c.
+// The block containing c->pos is only valid from c->pos onwards.
+static void jpeg_resume(const struct checkpoint *c)
+{
+    uint8_t *buf = stream.buf;
+    int i;
+
+    cbd_buf_owner = CBD_JPEG;
+    jpeg_stats.resumes++;
+
+    stream.minblk = c->pos / BLKSIZE;
+    stream.minblk_ptr = buf;
+    stream.tail = buf;
+    stream.endblk = 0;
+    stream.minblk_partial = c->pos % BLKSIZE != 0;
+
+    cmd = c->cmd;
+    y = c->y;
+    row_base = c->row_base;
+    start_page(c->page);
+    jpeg.buf = buf + c->pos % BLKSIZE;
+    jpeg.leftover_bits = c->leftover_bits;
+    jpeg.num_leftover_bits = c->num_leftover_bits;
+
+    arena_reset();
+
+    // rebuild the chain from its end
+    chain = &end;
+    for (i = c->num_fgm - 1; i >= 0; i--) {
+        struct fgm_ctl *item;
+
+        switch (c->fgm[i].type) {
+        case FGM_PICTURE:
+            item = alloc(FGM_PICTURE);
+            item->state->pic = c->fgm[i].pic;
+            item->render = render_pic;
+            break;
+
+        case FGM_QR:
+            item = alloc(FGM_QR);
+            item->state->qr.size = c->fgm[i].qr.size;
+            item->state->qr.idx = c->fgm[i].qr.idx;
+            item->state->qr.row = c->fgm[i].qr.row;
+            qr_encode(texts[c->fgm[i].qr.idx], item->state->qr.qr,
+                      c->fgm[i].qr.size);
+            item->render = render_qr;
+            break;
+
+        default:
+            item = alloc(FGM_TEXT);
+            item->state->text = c->fgm[i].text;
+            item->render = render_text;
+            break;
+        }
+
+        item->x = c->fgm[i].x;
+        item->next = chain;
+        chain = item;
+    }
+}
+
+// Find the last checkpoint from which block blk can be produced.
+static const struct checkpoint * find_checkpoint(unsigned blk)
+{
+    const struct checkpoint *c = 0;
+    unsigned i;
+
+    for (i = 0; i < num_checkpoints
+            && (checkpoints[i].pos + BLKSIZE - 1) / BLKSIZE <= blk; i++)
+        c = &checkpoints[i];
+    return c;
+}
+
+// Find the Huffman tables in jpeg_header.
+static void find_huffman_tables(void)
+{
+    const uint8_t *p = jpeg_header + 2;     // skip SOI
+
+    while (p[1] != SOS) {
+        unsigned len = p[2] << 8 | p[3];
+
+        if (p[1] == DHT) {
+            const uint8_t *t = p + 4;
+            while (t < p + 2 + len) {
+                unsigned n = 0, i;
+                for (i = 1; i <= 16; i++)
+                    n += t[i];
+                if (t[0] == 0x00)
+                    dht_dc = t + 1;     // class 0 (DC), table 0
+                else if (t[0] == 0x10)
+                    dht_ac = t + 1;     // class 1 (AC), table 0
+                t += 1 + 16 + n;
+            }
+        }
+        p += 2 + len;
+    }
+    assert(dht_dc && dht_ac);
+}
+
+void jpeg_set_read_ahead(unsigned blocks)
+{
+    read_ahead.watermark = blocks;
+}
+
+void jpeg_set_sequential(bool sequential)
+{
+    keep_behind = sequential ? 0 : KEEP_BEHIND;
+}
 
-    copy_bitstream(0, 0, GTW_LEN, GTW_BITS, JWIDTH - 1);
-    dy = 1;
+void jpeg_set_pages(unsigned n, void (*prepare)(unsigned page))
+{
+    assert(n > 0 && n < 256);
+    pages = n;
+    new_page = prepare;
+}
+
+void jpeg_set_restart_interval(unsigned rows)
+{
+    assert(rows * JWIDTH <= 0xffff);
+    restart_rows = rows;
+    if (rows && !dht_ac)
+        find_huffman_tables();
+}
 
-    memset(pic_fragments, 0, sizeof pic_fragments);
-    memset(qr_fragments, 0, sizeof qr_fragments);
-    memset(text_fragments, 0, sizeof text_fragments);
+static void make_qr_encoding(void)
+{
+    unsigned i, k;
+
+    for (i = 0; i < 2 << QR_WINDOW; i++) {
+        uint64_t bits = 0;
+        unsigned len = 0;
+        for (k = 0; k < QR_WINDOW; k++) {
+            unsigned e = i >> k & 3;
+            bits = bits << jpeg_encoding[e].len | jpeg_encoding[e].bits;
+            len += jpeg_encoding[e].len;
+        }
+        qr_encoding[i].hi_len = len > 32 ? len - 32 : 0;
+        qr_encoding[i].lo_len = len - qr_encoding[i].hi_len;
+        qr_encoding[i].hi = bits >> qr_encoding[i].lo_len;
+        qr_encoding[i].lo = bits & (((uint64_t) 1 << qr_encoding[i].lo_len) - 1);
+    }
+}
+
+// Return the number of macroblock rows of the fragment started by c.
+static unsigned fgm_height(const struct Layout_cmd *c)
+{
+    const char *text;
+    unsigned lines = 0;
+
+    switch (c->type) {
+    case FGM_PICTURE:
+        return c->item->pic[2] & 0xff;
+    case FGM_QR:
+        return c->item->qr.size;
+    case FGM_TEXT:
+        // break lines the way render_text() does
+        text = texts[c->item->text.idx];
+        do {
+            text += line_length(text, c->item->text.width);
+            if (*text == ' ')
+                text++;
+            lines++;
+        } while (*text && lines < JHEIGHT / CHR_HEIGHT);
+        return lines * CHR_HEIGHT;
+    default:
+        return 0;
+    }
+}
+
+// Return the start of the fragment arena at the end of the stream buffer,
+// sized for the peak number of fragments of each type in the compiled layout.
+static uint8_t * arena_start(uint8_t *endbuf)
+{
+    uint16_t end_row[LAYOUT_MAX_COMMANDS];
+    unsigned peak[FGM_STOP] = { 0 };
+    size_t size = 0;
+    int i, j, t;
+
+    for (i = 0; commands[i].type != FGM_STOP; i++)
+        end_row[i] = commands[i].row + fgm_height(&commands[i]);
+
+    for (i = 0; commands[i].type != FGM_STOP; i++) {
+        unsigned count[FGM_STOP] = { 0 }, total = 0;
+
+        // fragments active when this one starts
+        for (j = 0; commands[j].row <= commands[i].row
+                && commands[j].type != FGM_STOP; j++) {
+            if (commands[j].type != FGM_LARGE_PICTURE
+                    && end_row[j] > commands[i].row) {
+                count[commands[j].type]++;
+                total++;
+            }
+        }
+        assert(total <= MAX_FRAGMENTS);
+        for (t = 0; t < FGM_STOP; t++)
+            if (count[t] > peak[t])
+                peak[t] = count[t];
+    }
 
-    jpeg_fill();
+    for (t = 0; t < FGM_STOP; t++)
+        size += peak[t] * fgm_size[t];
+    return (uint8_t *) ((uintptr_t) (endbuf - size)
+                        & -__alignof__ (struct fgm_ctl));
 }
 
 void jpeg_init(uint8_t *buf, uint8_t *endbuf, const struct Layout *l)
 {
+    make_qr_encoding();
+
+    // resolve the layout conditions once for the whole image
+    unsigned n = layout_compile(l, commands, LAYOUT_MAX_COMMANDS);
+    assert(n);
+
+    // each page after the first starts gap rows below the previous page's
+    // FGM_REPEAT, which adds the same number of rows to the image each time
+    height = commands[n - 1].row;
+    for (repeat = commands; repeat->type != FGM_STOP; repeat++) {
+        if (repeat->type == FGM_REPEAT) {
+            height += (pages - 1) * (repeat->row + repeat->item->repeat.gap
+                                     - commands[0].row);
+            break;
+        }
+    }
+    if (repeat->type != FGM_REPEAT)
+        repeat = 0;
+
+    // the texts of the first page determine the heights of text fragments
+    start_page(1);
+    arena.start = arena_start(endbuf);
+    arena.end = endbuf;
+
     stream.buf = buf;
-    stream.end = endbuf;
-    stream.layout = l;
+    stream.end = arena.start;
+    assert(stream.end - stream.buf >= (keep_behind ? MIN_STREAM_SIZE
+                                                   : MIN_SEQUENTIAL_SIZE));
+
+    // the stream buffer content and checkpoints refer to the previous image
+    cbd_buf_owner = CBD_NONE;
+    stream.size = 0;
+    num_checkpoints = 0;
+    checkpoint_interval = CHECKPOINT_INTERVAL;
+    read_ahead.next = 0;
+    read_ahead.blocks = 0;
 
 #if USE_EXT_FLASH
+    lay_cache_init();
     FRESULT res = f_open(&lay_file, "0:default.lay", FA_READ);
     if (res != FR_OK) {
         // probably no such file
@@ -551,38 +1233,37 @@ static bool jpeg_more(void)
 {
     struct fgm_ctl **fgm;
 
-    // skip fragments whose condition is false
-    while (layout_conditions[layout->cond_idx] != layout->cond_val)
-        layout++;
-
     if (chain->next == 0) {
         // no active fragments; output whitespace until the next layout item
-        int gap = layout->vstep - dy;
+        int gap = cmd->row + row_base - y;
         if (gap > 20) {
-            gap = 20;
-            whitespace(gap * JWIDTH);
-            dy += gap;
+            white_rows(20);
             return true;
         }
-        if (gap)
-            whitespace(gap * JWIDTH);
-        dy += gap;
+        white_rows(gap);
     }
 
-    for (;;) {
+    while (cmd->row + row_base == y) {
+        const struct Layout *item = cmd->item;
         const uint16_t *pic;
 
-        // check condition and skip if necessary
-        while (layout_conditions[layout->cond_idx] != layout->cond_val)
-            layout++;
-
-        if (dy != layout->vstep)
-            break;
+        if (cmd->type == FGM_REPEAT) {
+            if (page < pages) {
+                // the next page starts from the first item again
+                row_base = y + item->repeat.gap - commands[0].row;
+                cmd = commands;
+                start_page(page + 1);
+            } else
+                cmd++;          // the last page is followed by the rest
+            if (chain == &end)
+                return true;    // nothing to render on this row yet
+            continue;
+        }
 
         // next layout item becomes active
 
-        if (layout->type == FGM_LARGE_PICTURE) {
-            pic = layout++->pic;
+        if (cmd->type == FGM_LARGE_PICTURE) {
+            pic = item->pic;
             // pic points at the body, which consists of uint16_t fields:
             //  addr_l    - address in serial flash, lower word
             //  addr_h    - address in serial flash, higher word
@@ -591,24 +1272,27 @@ static bool jpeg_more(void)
             //  nbits     - number of leftover bits to follow
             //  [bits]    - leftover bits if nbits > 0
             unsigned addr = pic[0] | pic[1] << 16;      // address in flash
-            int vgap = layout->vstep - pic[2];          // step minus height
-            copy_bitstream_from_flash(addr, pic[3], pic[4], pic[5], vgap * JWIDTH);
-            dy = layout->vstep;
+            if (restart_rows)
+                copy_rows_with_restarts(addr, pic[2], pic[3], pic[4], pic[5]);
+            else {
+                copy_bitstream_from_flash(addr, pic[3], pic[4], pic[5], 0);
+                y += pic[2];
+            }
+            cmd++;
+            white_rows(cmd->row + row_base - y);
             return true;
         }
 
         struct fgm_ctl *new_item = &end;
         uint16_t shift = 0;
 
-        dy = 0;
-
-        switch (layout->type) {
+        switch (cmd->type) {
         case FGM_STOP:
             finalise_jpeg();
             return false;
 
         case FGM_PICTURE:
-            pic = layout->pic;
+            pic = item->pic;
             // pic points at body of uint16_t fields:
             //  addr_l              - address in flash, lower word
             //  addr_h              - address in flash, higher word
@@ -616,7 +1300,7 @@ static bool jpeg_more(void)
             //  then for each row (height times):
             //    { nbits, nwords } - bitstream parameters
             //    [bits]            - leftover bits if nbits > 0
-            new_item = ALLOC(pic_fragments);
+            new_item = alloc(FGM_PICTURE);
             new_item->state->pic.addr = pic[0] | pic[1] << 16;  // addr in flash
             new_item->state->pic.rows_left = pic[2] & 0xff;     // height
             new_item->state->pic.width = pic[2] >> 8;           // width
@@ -625,23 +1309,23 @@ static bool jpeg_more(void)
             break;
 
         case FGM_QR:
-            new_item = ALLOC(qr_fragments);
+            new_item = alloc(FGM_QR);
             new_item->state->qr.row = 0;
-            new_item->state->qr.idx = layout->qr.idx;
-            new_item->state->qr.size = layout->qr.size;
-            qr_encode(texts[layout->qr.idx], new_item->state->qr.qr,
-                      layout->qr.size);
+            new_item->state->qr.idx = item->qr.idx;
+            new_item->state->qr.size = item->qr.size;
+            qr_encode(texts[item->qr.idx], new_item->state->qr.qr,
+                      item->qr.size);
             new_item->render = render_qr;
             break;
 
         case FGM_TEXT:
-            new_item = ALLOC(text_fragments);
-            new_item->state->text.idx = layout->text.idx;
-            new_item->state->text.width = layout->text.width;
-            new_item->state->text.text = texts[layout->text.idx];
-            if (layout->text.centre) {
-                shift = (layout->text.centre - strnlen(texts[layout->text.idx],
-                            layout->text.centre)) * CHR_WIDTH / 2;
+            new_item = alloc(FGM_TEXT);
+            new_item->state->text.idx = item->text.idx;
+            new_item->state->text.width = item->text.width;
+            new_item->state->text.text = texts[item->text.idx];
+            if (item->text.centre) {
+                shift = (item->text.centre - strnlen(texts[item->text.idx],
+                            item->text.centre)) * CHR_WIDTH / 2;
             }
             new_item->state->text.row = 0;
             new_item->render = render_text;
@@ -652,17 +1336,20 @@ static bool jpeg_more(void)
         }
 
         // insert new_item into the chain according to x
-        new_item->x = layout->x + shift;
+        new_item->x = cmd->x + shift;
         for (fgm = &chain; (*fgm)->x < new_item->x; fgm = &(*fgm)->next);
         new_item->next = *fgm;
         *fgm = new_item;
-
-        layout++;
+        cmd++;
     }
 
     // render current row; we know it's not empty
     unsigned x = chain->x;
-    whitespace(x);
+    if (band_start()) {
+        assert(x > 0);  // fragments expect to start after white
+        copy_bitstream(0, 0, GTW_LEN, GTW_BITS, x - 1);
+    } else
+        whitespace(x);
     fgm = &chain;
     do {
         unsigned next_x = (*fgm)->next->x;
@@ -677,7 +1364,7 @@ static bool jpeg_more(void)
         }
     } while ((*fgm)->next != 0);
 
-    dy++;
+    y++;
 
     return true;
 }
@@ -687,32 +1374,33 @@ static bool jpeg_debug_more(void)
 {
     uint8_t *prev = jpeg.buf;
     bool res = jpeg_more();
-    printf("jpeg_more(): consumed %5d, dy %u, layout %d\n", jpeg.buf - prev,
-            dy, layout >= shamir_layout ? layout - shamir_layout : layout - main_layout);
+    printf("jpeg_more(): consumed %5d, y %u, command %d\n", jpeg.buf - prev,
+            y, cmd - commands);
     jpeg_dump();
     return res;
 }
 #define jpeg_more   jpeg_debug_more
 #endif
 
-static void jpeg_fill(void)
+// Generate the image until the stream position reaches target, or the
+// buffer is full.
+static void jpeg_fill(unsigned target)
 {
     if (stream.endblk)
         return;
 
-    enum {
-        // Maximum size of data that a single call to jpeg_more can generate.
-        // This is usually the maximum size (in bytes) of one macroblock row
-        // and determined empirically.  It shouldn't exceed 1/2.5 of the space
-        // available for jpeg buffering, i.e. entropy_size.
-        RESERVE = 10 * 1024
-    };
-
     uint8_t *limit = stream.minblk_ptr > jpeg.buf ? stream.minblk_ptr :
                                                     stream.end;
     limit -= RESERVE;
-    while (jpeg.buf <= limit)
-        if (!jpeg_more()) {
+    while (jpeg.buf <= limit && stream_pos() < target) {
+        save_checkpoint();
+
+        uint8_t *prev = jpeg.buf;
+        bool more = jpeg_more();
+        jpeg_stats.bytes += jpeg.buf - prev;
+
+        if (!more) {
+            stream.size = stream_pos();
             int left = ((stream.buf - jpeg.buf) & (BLKSIZE - 1)) + BLKSIZE;
             memset(jpeg.buf, 0xff, left);
             jpeg.buf += left;
@@ -722,40 +1410,64 @@ static void jpeg_fill(void)
                 ) / BLKSIZE;
             return;
         }
+    }
     assert(jpeg.buf <= limit + RESERVE);
 
-    if (jpeg.buf < stream.minblk_ptr)
+    if (jpeg.buf <= limit || jpeg.buf < stream.minblk_ptr)
         return;
 
-    // We hit the end of the buffer, let's move to the beginning
-    // if there is space.
-    if (stream.minblk_ptr >= stream.buf + BLKSIZE) {
-        int carry = (jpeg.buf - stream.buf) & (BLKSIZE - 1);
+    // We hit the end of the buffer, let's move to the beginning if there is
+    // space to generate more there, or if minblk is the partial block, which
+    // moves along.  Otherwise the buffer holds all blocks up to
+    // minblk + keep_behind + 1, and minblk has to move first.
+    int carry = (jpeg.buf - stream.buf) & (BLKSIZE - 1);
+    if (stream.minblk_ptr >= stream.buf + RESERVE + BLKSIZE
+            || stream.minblk_ptr == jpeg.buf - carry) {
         stream.tail = jpeg.buf - carry;
         if (carry)
             memcpy(stream.buf, stream.tail, carry);
+        if (stream.minblk_ptr == stream.tail)
+            stream.minblk_ptr = stream.buf;
         jpeg.buf = stream.buf + carry;
+        jpeg_stats.wraps++;
     }
 }
 
-uint8_t * jpeg_get_block(unsigned blk)
+// Return block blk, making sure that the following ahead blocks are being
+// generated too.
+static uint8_t * get_block(unsigned blk, unsigned ahead)
 {
-    if (cbd_buf_owner != CBD_JPEG || blk < stream.minblk) {
+    bool valid = cbd_buf_owner == CBD_JPEG && blk >= stream.minblk
+        && !(blk == stream.minblk && stream.minblk_partial);
+    const struct checkpoint *c = find_checkpoint(blk);
+    unsigned target = (blk + 1 + ahead) * BLKSIZE;
+
+    // Restart if the block is no longer in the buffer, or skip ahead if there
+    // is a checkpoint beyond what we have generated so far.
+    if (!valid || (c && !stream.endblk && c->pos > stream_pos())) {
 #if DEBUG
         printf("Requested block %u, ", blk);
         if (cbd_buf_owner == CBD_JPEG)
-            printf ("minimum now %u.  Restarting.\n", stream.minblk);
+            printf ("minimum now %u.  ", stream.minblk);
+        else
+            printf ("taking ownership from %u.  ", cbd_buf_owner);
+        if (c)
+            printf("Resuming at %u.\n", c->pos);
         else
-            printf ("taking ownership from %u.  Restarting.\n", cbd_buf_owner);
+            printf("Restarting.\n");
 #endif
-        jpeg_start();
+        if (c)
+            jpeg_resume(c);
+        else
+            jpeg_start();
     }
 
-    for (; blk > stream.minblk + 4; jpeg_fill()) {
+    for (; blk > stream.minblk + keep_behind; jpeg_fill(target)) {
         if (jpeg.buf < stream.minblk_ptr) {
             if (stream.minblk_ptr < stream.tail) {
                 stream.minblk++;
                 stream.minblk_ptr += BLKSIZE;
+                stream.minblk_partial = false;
                 continue;
             }
             stream.minblk_ptr = stream.buf;
@@ -763,13 +1475,20 @@ uint8_t * jpeg_get_block(unsigned blk)
         if (jpeg.buf >= stream.minblk_ptr + BLKSIZE) {
             stream.minblk++;
             stream.minblk_ptr += BLKSIZE;
+            stream.minblk_partial = false;
             continue;
         }
         if (stream.endblk && blk >= stream.endblk)
             return jpeg.buf - BLKSIZE;
     }
 
-    // Here stream.minblk <= blk <= stream.minblk + 4.
+    // Here stream.minblk <= blk <= stream.minblk + keep_behind.
+
+    // Generate ahead as far as there is room, and up to the end of blk at
+    // least; a full buffer holds more than keep_behind + 1 blocks.
+    do
+        jpeg_fill(target);
+    while (!stream.endblk && stream_pos() < (blk + 1) * BLKSIZE);
 
     if (stream.endblk && blk >= stream.endblk)
         return jpeg.buf - BLKSIZE;
@@ -781,3 +1500,95 @@ uint8_t * jpeg_get_block(unsigned blk)
 
     return blk_ptr;
 }
+
+// Count requests that have to wait for their block to be generated.
+static void count_stall(unsigned blk)
+{
+    if (cbd_buf_owner != CBD_JPEG || blk < stream.minblk
+            || (!stream.endblk && stream_pos() < (blk + 1) * BLKSIZE))
+        jpeg_stats.stalls++;
+}
+
+uint8_t * jpeg_get_block(unsigned blk)
+{
+    count_stall(blk);
+
+    return get_block(blk, read_ahead.blocks);
+}
+
+// Return block blk like jpeg_get_block(), and through *n the number of
+// blocks from blk (at most *n) that follow it contiguously in the buffer.
+// The rest of the run is generated along with blk.
+uint8_t * jpeg_get_blocks(unsigned blk, unsigned *n)
+{
+    uint8_t *blk_ptr;
+    unsigned avail = 1;
+
+    count_stall(blk);
+    blk_ptr = get_block(blk, read_ahead.blocks > *n - 1 ? read_ahead.blocks
+                                                        : *n - 1);
+
+    if (!stream.endblk || blk < stream.endblk) {
+        // data is contiguous up to jpeg.buf, or up to tail before the wrap
+        uint8_t *limit = blk_ptr <= jpeg.buf ? jpeg.buf : stream.tail;
+        avail = (limit - blk_ptr) / BLKSIZE;
+        if (stream.endblk && avail > stream.endblk - blk)
+            avail = stream.endblk - blk;
+        if (!avail)
+            avail = 1;
+    }
+    if (*n > avail)
+        *n = avail;
+
+    return blk_ptr;
+}
+
+// Note the end of a request for n blocks, which block blk follows, and
+// generate ahead for the next request.
+void jpeg_read_ahead(unsigned blk, unsigned n)
+{
+    if (n <= blk && blk - n == read_ahead.next) {
+        // sequential access: stay two requests ahead
+        read_ahead.blocks = 2 * n;
+        if (read_ahead.watermark && read_ahead.blocks > read_ahead.watermark)
+            read_ahead.blocks = read_ahead.watermark;
+    } else {
+        read_ahead.blocks = 0;
+    }
+    read_ahead.next = blk;
+
+    if (read_ahead.blocks)
+        get_block(blk, read_ahead.blocks - 1);
+}
+
+#if JPEG_DIAGNOSTICS
+void jpeg_diag_print(void)
+{
+    static struct Jpeg_stats printed;
+
+    if (memcmp(&printed, &jpeg_stats, sizeof printed) == 0)
+        return;
+    printed = jpeg_stats;
+
+    printf("jpeg: %u restarts, %u resumes, %u stalls, %u wraps, %lu bytes\n",
+            jpeg_stats.restarts, jpeg_stats.resumes, jpeg_stats.stalls,
+            jpeg_stats.wraps, jpeg_stats.bytes);
+}
+#endif
+
+// Return the exact size of the image in bytes.  The first call generates
+// the whole image, leaving checkpoints for later random access.
+unsigned jpeg_size(void)
+{
+    unsigned blk = 0;
+
+    while (!stream.size)
+        get_block(blk++, 0);
+    return stream.size;
+}
+
+// Return the image height in pixels, known from jpeg_init().
+unsigned jpeg_height(void)
+{
+    return height * 8;
+}
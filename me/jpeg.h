@@ -20,11 +20,55 @@
 #ifndef JPEG_H_INCLUDED
 #define JPEG_H_INCLUDED
 
+#include <stdbool.h>
+
 #include "layout.h"
 
+// Enable diagnostic output?
+#ifndef JPEG_DIAGNOSTICS
+#define JPEG_DIAGNOSTICS 0
+#endif
+
 //size_t make_jpeg(uint8_t *buf, const struct Layout *layout);
 
 void jpeg_init(uint8_t *buf, uint8_t *end, const struct Layout *l);
 uint8_t * jpeg_get_block(unsigned blk);
+uint8_t * jpeg_get_blocks(unsigned blk, unsigned *n);
+unsigned jpeg_size(void);
+unsigned jpeg_height(void);
+// Tell the generator that a request for n blocks ended before block blk,
+// so that it can generate ahead for the next one.
+void jpeg_read_ahead(unsigned blk, unsigned n);
+// Generate at most blocks ahead of the host's requests (0 for no limit).
+void jpeg_set_read_ahead(unsigned blocks);
+// The stream is read only once, in order, by another generator: keep no
+// blocks behind the requested one, which lets the stream buffer be little
+// more than one macroblock row.  Call before jpeg_init().
+void jpeg_set_sequential(bool sequential);
+// Output a restart marker every rows macroblock rows (0 to disable).
+// Call before jpeg_init().
+void jpeg_set_restart_interval(unsigned rows);
+// Output the items of a layout up to its FGM_REPEAT n times, as n pages,
+// followed by the rest of the layout once.  Before each page is rendered,
+// prepare(page) is called, from 1, to put its texts into place.
+// Call before jpeg_init().
+void jpeg_set_pages(unsigned n, void (*prepare)(unsigned page));
+
+// Streaming statistics.
+struct Jpeg_stats {
+    unsigned restarts;      // image generation started from the top
+    unsigned resumes;       // image generation resumed from a checkpoint
+    unsigned stalls;        // requests waiting for their block to be generated
+    unsigned wraps;         // wrap-arounds of the stream buffer
+    unsigned long bytes;    // total bytes generated
+};
+extern struct Jpeg_stats jpeg_stats;
+
+// Print the streaming statistics when they have changed.
+#if JPEG_DIAGNOSTICS
+void jpeg_diag_print(void);
+#else
+#define jpeg_diag_print()
+#endif
 
 #endif
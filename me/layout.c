@@ -33,6 +33,28 @@
 
 uint8_t layout_conditions[COND_NUM_ELEMENTS];
 
+unsigned layout_compile(const struct Layout *layout, struct Layout_cmd *cmd,
+                        unsigned max)
+{
+    unsigned n = 0, row = 0;
+
+    do {
+        // skip fragments whose condition is false
+        while (layout_conditions[layout->cond_idx] != layout->cond_val)
+            layout++;
+        if (n == max)
+            return 0;
+        row += layout->vstep;
+        cmd[n].row = row;
+        cmd[n].type = layout->type;
+        cmd[n].x = layout->x;
+        cmd[n].item = layout;
+        n++;
+    } while (layout++->type != FGM_STOP);
+
+    return n;
+}
+
 const struct Layout main_layout[] = {
     {
         .type   = FGM_PICTURE,
@@ -158,6 +180,8 @@ const struct Layout main_layout[] = {
     },
 };
 
+// One page per share.  With the default 2-of-3 shares, three pages fit on
+// one sheet of paper.
 const struct Layout shamir_layout[] = {
     {
         .type   = FGM_PICTURE,
@@ -166,13 +190,14 @@ const struct Layout shamir_layout[] = {
         .pic    = private_key_fragment,             // 28x7
     },
     {
-        .type   = FGM_PICTURE,
-        .x      = 170,
-        .pic    = share_1_of_3_fragment,            // 30x7
+        .type   = FGM_TEXT,
+        .vstep  = 1,
+        .x      = 171,
+        .text   = { .idx = IDX_SSS_LABEL, .width = 11 },
     },
     {
         .type   = FGM_PICTURE,
-        .vstep  = 6,
+        .vstep  = 5,
         .x      = (JWIDTH - LOGO_TOP_FRAGMENT_WIDTH + 1) / 2,
         .pic    = logo_top_fragment,
     },
@@ -207,136 +232,23 @@ const struct Layout shamir_layout[] = {
     },
     {
         .type   = FGM_PICTURE,
+        .cond_idx = COND_ANY_TWO,
+        .cond_val = 1,
         .x      = JWIDTH - 73 - 19,
         .pic    = any_two_shares_reveal_fragment,   // 74x7
     },
-    {
-        .type   = FGM_QR,
-        .vstep  = 9,
-        .x      = JWIDTH - 33 - 37 - 20,
-        .qr     = { .idx = IDX_SSS_PART(1), .size = QR_SIZE(4) },
-    },
-    {
-        .type   = FGM_QR,
-        .vstep  = 2,
-        .x      = 20,
-        .qr     = { .idx = IDX_ADDRESS, .size = QR_SIZE(3) },
-    },
-    {
-        .type   = FGM_TEXT,
-        .vstep  = 0,
-        .x      = JWIDTH - 20 - 33,
-        .text   = { .idx = IDX_SSS_PART(1), .width = 11 },
-    },
     {
         .type   = FGM_TEXT,
-        .vstep  = 7,
-        .x      = 20 + 29 + 4,
-        .text   = { .idx = IDX_ADDRESS, .width = 12 },
-    },
-    {
-        .type   = FGM_PICTURE,
-        .vstep  = LOGO_TOP_FRAGMENT_HEIGHT - 19,
-        .x      = (JWIDTH - LOGO_MIDDLE_FRAGMENT_WIDTH + 1) / 2,
-        .pic    = logo_middle_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .vstep  = LOGO_MIDDLE_FRAGMENT_HEIGHT,
-        .x      = (JWIDTH - LOGO_BOTTOM_FRAGMENT_WIDTH + 1) / 2,
-        .pic    = logo_bottom_fragment,             // 66x13
-    },
-    //-------- unsalted layout: more space between sections ------------
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 0,
-        .vstep  = 13 + 4,
-        .x      = JWIDTH - 19 - SMALL_PRINT_FRAGMENT_WIDTH,
-        .pic    = small_print_fragment,
-    },
-    {
-        .type   = FGM_LARGE_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 0,
-        .vstep  = 5 + 7,
-        .pic    = cut_here_fragment,                // 5
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_SALT,
+        .cond_idx = COND_ANY_TWO,
         .cond_val = 0,
-        .vstep  = 5 + 10,
-        .x      = 142,
-        .pic    = private_key_fragment,             // 28x7
-    },
-    //-------- salted layout: condensed sections -----------------------
-    {
-        .type   = FGM_LARGE_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 1,
-        .vstep  = 13 + 4,
-        .pic    = cut_here_fragment,                // 5
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 1,
-        .vstep  = 5 + 4,
-        .x      = 142,
-        .pic    = private_key_fragment,             // 28x7
-    },
-    //------------------------------------------------------------------
-    {
-        .type   = FGM_PICTURE,
-        .x      = 170,
-        .pic    = share_2_of_3_fragment,            // 30x7
-    },
-    {
-        .type   = FGM_PICTURE,
-        .vstep  = 6,
-        .x      = (JWIDTH - LOGO_TOP_FRAGMENT_WIDTH + 1) / 2,
-        .pic    = logo_top_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_COIN,
-        .cond_val = COIN_BIP44(BITCOIN),
-        .vstep  = 1,
-        .x      = 56 - BITCOIN_FRAGMENT_WIDTH,
-        .pic    = bitcoin_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_COIN,
-        .cond_val = COIN_BIP44(LITECOIN),
-        .vstep  = 1,
-        .x      = 56 - LITECOIN_FRAGMENT_WIDTH,
-        .pic    = litecoin_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_COIN,
-        .cond_val = COIN_BIP44(PEERCOIN),
-        .vstep  = 1,
-        .x      = 56 - PEERCOIN_FRAGMENT_WIDTH,
-        .pic    = peercoin_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .x      = 56,
-        .pic    = address_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .x      = JWIDTH - 73 - 19,
-        .pic    = any_two_shares_reveal_fragment,   // 74x7
+        .x      = JWIDTH - 20 * CHR_WIDTH - 20,
+        .text   = { .idx = IDX_SSS_THRESHOLD, .width = 20 },
     },
     {
         .type   = FGM_QR,
         .vstep  = 9,
         .x      = JWIDTH - 33 - 37 - 20,
-        .qr     = { .idx = IDX_SSS_PART(2), .size = QR_SIZE(4) },
+        .qr     = { .idx = IDX_SSS_SHARE, .size = QR_SIZE(4) },
     },
     {
         .type   = FGM_QR,
@@ -348,7 +260,7 @@ const struct Layout shamir_layout[] = {
         .type   = FGM_TEXT,
         .vstep  = 0,
         .x      = JWIDTH - 20 - 33,
-        .text   = { .idx = IDX_SSS_PART(2), .width = 11 },
+        .text   = { .idx = IDX_SSS_SHARE, .width = 11 },
     },
     {
         .type   = FGM_TEXT,
@@ -368,7 +280,7 @@ const struct Layout shamir_layout[] = {
         .x      = (JWIDTH - LOGO_BOTTOM_FRAGMENT_WIDTH + 1) / 2,
         .pic    = logo_bottom_fragment,             // 66x13
     },
-    //-------- unsalted layout: more space between sections ------------
+    //-------- unsalted layout: more space between pages ---------------
     {
         .type   = FGM_PICTURE,
         .cond_idx = COND_SALT,
@@ -385,135 +297,32 @@ const struct Layout shamir_layout[] = {
         .pic    = cut_here_fragment,                // 5
     },
     {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 0,
-        .vstep  = 5 + 10,
-        .x      = 142,
-        .pic    = private_key_fragment,             // 28x7
-    },
-    //-------- salted layout: condensed sections -----------------------
-    {
-        .type   = FGM_LARGE_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 1,
-        .vstep  = 13 + 4,
-        .pic    = cut_here_fragment,                // 5
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_SALT,
-        .cond_val = 1,
-        .vstep  = 5 + 4,
-        .x      = 142,
-        .pic    = private_key_fragment,             // 28x7
-    },
-    //------------------------------------------------------------------
-    {
-        .type   = FGM_PICTURE,
-        .x      = 170,
-        .pic    = share_3_of_3_fragment,            // 30x7
-    },
-    {
-        .type   = FGM_PICTURE,
-        .vstep  = 6,
-        .x      = (JWIDTH - LOGO_TOP_FRAGMENT_WIDTH + 1) / 2,
-        .pic    = logo_top_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_COIN,
-        .cond_val = COIN_BIP44(BITCOIN),
-        .vstep  = 1,
-        .x      = 56 - BITCOIN_FRAGMENT_WIDTH,
-        .pic    = bitcoin_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_COIN,
-        .cond_val = COIN_BIP44(LITECOIN),
-        .vstep  = 1,
-        .x      = 56 - LITECOIN_FRAGMENT_WIDTH,
-        .pic    = litecoin_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .cond_idx = COND_COIN,
-        .cond_val = COIN_BIP44(PEERCOIN),
-        .vstep  = 1,
-        .x      = 56 - PEERCOIN_FRAGMENT_WIDTH,
-        .pic    = peercoin_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .x      = 56,
-        .pic    = address_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .x      = JWIDTH - 73 - 19,
-        .pic    = any_two_shares_reveal_fragment,   // 74x7
-    },
-    {
-        .type   = FGM_QR,
-        .vstep  = 9,
-        .x      = JWIDTH - 33 - 37 - 20,
-        .qr     = { .idx = IDX_SSS_PART(3), .size = QR_SIZE(4) },
-    },
-    {
-        .type   = FGM_QR,
-        .vstep  = 2,
-        .x      = 20,
-        .qr     = { .idx = IDX_ADDRESS, .size = QR_SIZE(3) },
-    },
-    {
-        .type   = FGM_TEXT,
-        .vstep  = 0,
-        .x      = JWIDTH - 20 - 33,
-        .text   = { .idx = IDX_SSS_PART(3), .width = 11 },
-    },
-    {
-        .type   = FGM_TEXT,
-        .vstep  = 7,
-        .x      = 20 + 29 + 4,
-        .text   = { .idx = IDX_ADDRESS, .width = 12 },
-    },
-    {
-        .type   = FGM_PICTURE,
-        .vstep  = LOGO_TOP_FRAGMENT_HEIGHT - 19,
-        .x      = (JWIDTH - LOGO_MIDDLE_FRAGMENT_WIDTH + 1) / 2,
-        .pic    = logo_middle_fragment,
-    },
-    {
-        .type   = FGM_PICTURE,
-        .vstep  = LOGO_MIDDLE_FRAGMENT_HEIGHT,
-        .x      = (JWIDTH - LOGO_BOTTOM_FRAGMENT_WIDTH + 1) / 2,
-        .pic    = logo_bottom_fragment,             // 66x13
-    },
-    //-------- unsalted layout ends here -------------------------------
-    {
-        .type   = FGM_PICTURE,
+        .type   = FGM_REPEAT,
         .cond_idx = COND_SALT,
         .cond_val = 0,
-        .vstep  = 13 + 4,
-        .x      = JWIDTH - 19 - SMALL_PRINT_FRAGMENT_WIDTH,
-        .pic    = small_print_fragment,
+        .vstep  = 5,
+        .repeat = { .gap = 10 },
     },
     {
         .type   = FGM_STOP,
         .cond_idx = COND_SALT,
         .cond_val = 0,
-        .vstep  = JHEIGHT - 3 * (23 + 29 + 31) - 2 * 12 - 5,
+        .vstep  = JHEIGHT - 3 * (23 + 29 + 31) - 2 * 12 - 5 - 12 - 5,
     },
-    //-------- salt ----------------------------------------------------
+    //-------- salted layout: condensed pages, then the salt -----------
     {
         .type   = FGM_LARGE_PICTURE,
         .vstep  = 13 + 4,
         .pic    = cut_here_fragment,                // 5
     },
+    {
+        .type   = FGM_REPEAT,
+        .vstep  = 5,
+        .repeat = { .gap = 4 },
+    },
     {
         .type   = FGM_PICTURE,
-        .vstep  = 5 + 3,
+        .vstep  = 3,
         .x      = 20 + QR_SIZE(4) + 4,
         .pic    = entropy_for_verification_fragment,    // 57x7
     },
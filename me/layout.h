@@ -28,6 +28,7 @@ enum {
     FGM_PICTURE,
     FGM_QR,
     FGM_TEXT,
+    FGM_REPEAT,         // end of page, see jpeg_set_pages()
     FGM_STOP,
 };
 
@@ -36,17 +37,19 @@ enum {
     IDX_ADDRESS,
     IDX_XPUB     = IDX_ADDRESS,
     IDX_PRIVKEY,
-    IDX_UNSALTED = 4,
+    IDX_SSS_SHARE = IDX_PRIVKEY,    // Shamir's share on the current page
+    IDX_SSS_LABEL,                  // its number, "share x/n"
+    IDX_SSS_THRESHOLD,              // "any m shares reveal"
+    IDX_UNSALTED,
     IDX_HD_PATH,
 };
-// For Shamir's Secret Sharing part n of m
-#define IDX_SSS_PART(n) (n)
 
 // Conditional execution
 enum {
     COND_TRUE,          // unset cond_idx and cond_val => true
     COND_COIN,          // index of the coin type condition
     COND_SALT,          // index of the salt type condition
+    COND_ANY_TWO,       // 1 if any two Shamir's shares reveal the key
     COND_NUM_ELEMENTS   // number of condition variables
 };
 extern uint8_t layout_conditions[COND_NUM_ELEMENTS];
@@ -66,7 +69,7 @@ struct Layout {
         // QR code
         struct {
             uint16_t idx;       // text index IDX_xxx
-            uint16_t size;      // QR_SIZE(ver): between 29 and 41
+            uint16_t size;      // QR_SIZE(ver): between 29 and 57
         } qr;
 
         // text fragment
@@ -75,6 +78,11 @@ struct Layout {
             uint8_t  centre;    // width for centring, if not 0
             uint16_t width;     // width in characters
         } text;
+
+        // end of page
+        struct {
+            uint16_t gap;       // rows from here to the next page's first item
+        } repeat;
     };
 };
 
@@ -82,4 +90,22 @@ extern const struct Layout main_layout[];
 extern const struct Layout shamir_layout[];
 extern const struct Layout hd_layout[];
 
+// Layout item compiled for the current conditions.
+struct Layout_cmd {
+    uint16_t row;               // macroblock row where the item starts
+    uint8_t  type;              // FGM_xxx
+    uint8_t  x;                 // horizontal position
+    const struct Layout *item;  // source item, for the fragment parameters
+};
+
+// Maximum number of items in a compiled layout.  The built-in layouts compile
+// to at most 20; check reports any layout that doesn't fit.
+#define LAYOUT_MAX_COMMANDS 24
+
+// Compile a layout for the current layout_conditions into at most max
+// commands, ending with FGM_STOP.  Return the number of commands, or 0 if
+// they don't fit.
+unsigned layout_compile(const struct Layout *layout, struct Layout_cmd *cmd,
+                        unsigned max);
+
 #endif
@@ -30,12 +30,13 @@
 #include "sys/stdio-uart.h"
 #include "sys/now.h"
 #include "sys/sync.h"
-#include "lib/rs.h"
 #include "lib/fwsign.h"
 #include "ui.h"
 #include "sss.h"
 #include "jpeg.h"
 #include "jpeg-data.h"
+#include "pdf.h"
+#include "png.h"
 #include "xflash.h"
 #include "fs.h"
 #include "me-access.h"
@@ -67,18 +68,29 @@ unsigned cbd_num_sectors;   // total number of sectors on the device
 enum {      // indices of the CBD map entries for different content
     CBD_ENTRY_FS,           // filesystem metadata and readme.txt
     CBD_ENTRY_JPEG,         // JPEG file with keys and addresses
+    CBD_ENTRY_PDF,          // the same image wrapped in a PDF file
+    CBD_ENTRY_PNG,          // or a black and white PNG file instead of both
     CBD_ENTRY_ESRC,         // raw entropy sources
 };
 static void make_fs(void);
 static uint8_t * fs_get_block(unsigned blk);
+static uint8_t * fs_get_blocks(unsigned blk, unsigned *n);
 static uint8_t * esrc_get_block(unsigned blk);
 struct CBD_map_entry cbd_map[] = {
-    [CBD_ENTRY_FS]      = { .get_block = fs_get_block },
-    [CBD_ENTRY_JPEG]    = { .get_block = jpeg_get_block, .prefetchable = true },
+    [CBD_ENTRY_FS]      = { .get_block = fs_get_block,
+                            .get_blocks = fs_get_blocks },
+    [CBD_ENTRY_JPEG]    = { .get_block = jpeg_get_block,
+                            .get_blocks = jpeg_get_blocks,
+                            .read_ahead = jpeg_read_ahead },
+    [CBD_ENTRY_PDF]     = { .get_block = pdf_get_block,
+                            .get_blocks = pdf_get_blocks,
+                            .read_ahead = pdf_read_ahead },
+    [CBD_ENTRY_PNG]     = { .get_block = png_get_block,
+                            .get_blocks = png_get_blocks },
     [CBD_ENTRY_ESRC]    = { .get_block = esrc_get_block },
 };
 // File name prefix.
-static const char *prefix;
+static char prefix[12];
 
 bool configuration_mode;
 
@@ -208,27 +220,34 @@ generate_new_key:
     else
         layout_conditions[COND_COIN] = settings.coin.bip44;
     layout_conditions[COND_SALT] = settings.salt_type;
+    layout_conditions[COND_ANY_TWO] = settings.sss_m == 2;
+
+    // the PNG generator takes its buffer from the end of the JPEG one, and
+    // is the only reader of the JPEG stream
+    uint8_t *end = (uint8_t *) &__ram_end__;
+    if (settings.image == IMAGE_PNG)
+        end -= PNG_BUF_SIZE;
+    jpeg_set_sequential(settings.image == IMAGE_PNG);
 
     int mode = ui_btn_count;
     if (settings.hd) {
         // HD mode does not support Shamir's secret sharing or salt yet
-        cbd_num_sectors = 432 + settings.salt_type * 140;
-        jpeg_init(_estack.stream_buf, (uint8_t *) &__ram_end__, hd_layout);
-        prefix = "";
+        jpeg_init(_estack.stream_buf, end, hd_layout);
+        prefix[0] = 0;
     } else if (mode) {
-        // generate 2-of-3 Shamir's shares
-        cbd_num_sectors = 928 + settings.salt_type * 80;
-        rs_init(0x11d, 1);  // initialise GF(2^8) for Shamir
-        sss_encode(2, 3, SSS_BASE58, key, len);
-        jpeg_init(_estack.stream_buf, (uint8_t *) &__ram_end__, shamir_layout);
-        prefix = "2-of-3 ";
+        // generate m-of-n Shamir's shares, one page each, as they are needed
+        sss_encode(settings.sss_m, settings.sss_n, SSS_BASE58, key, len);
+        jpeg_set_pages(settings.sss_n, sss_share);
+        jpeg_init(_estack.stream_buf, end, shamir_layout);
+        sprintf(prefix, "%d-of-%d ", settings.sss_m, settings.sss_n);
     } else {
         // generate regular private key in Wallet Import Format (aka SIPA)
-        cbd_num_sectors = 312 + settings.salt_type * 140;
-        jpeg_init(_estack.stream_buf, (uint8_t *) &__ram_end__, main_layout);
-        prefix = "";
+        jpeg_init(_estack.stream_buf, end, main_layout);
+        prefix[0] = 0;
     }
-    cbd_buf_owner = CBD_NONE;
+    if (settings.image == IMAGE_PNG)
+        png_init(end, end + PNG_BUF_SIZE);
+    cbd_num_sectors = 0;
     make_fs();
     ui_off();
     LED_On(LED0);
@@ -265,6 +284,7 @@ generate_new_key:
         }
 
         sync_diag_print();
+        jpeg_diag_print();
 
         if (ui_btn_count) {
             // unload medium and make another key
@@ -376,6 +396,19 @@ static uint8_t * write_ptr(unsigned secno)
     return _estack.stream_buf + secno * 512;
 }
 
+// Add an empty file of len bytes, named after the address with extension ext.
+static void add_file(FIL *file, char *name, const char *ext, unsigned len)
+{
+    sprintf(name, "1:%s%.35s.%s", prefix, texts[IDX_ADDRESS], ext);
+    f_open(file, name, FA_WRITE | FA_CREATE_ALWAYS);
+    FRESULT res = f_lseek(file, len);
+    if (res != FR_OK)
+        printf("f_lseek: %d\n", res);
+    res = f_close(file);
+    if (res != FR_OK)
+        printf("f_close: %d\n", res);
+}
+
 static void make_fs(void)
 {
     enum {
@@ -394,9 +427,31 @@ static void make_fs(void)
     FIL file;
     UINT bytes_written;
 
+    // Size the volume to fit the filesystem structures, readme.txt, and
+    // either the JPEG and PDF files or the PNG file exactly.  The size of the
+    // FAT depends on the volume size.  jpeg_size() and png_size() generate
+    // the image when first called.
+    bool png = settings.image == IMAGE_PNG;
+    unsigned jpeg_len = 0, pdf_len = 0, png_len = 0;
+    if (png) {
+        png_len = png_size();
+    } else {
+        jpeg_len = jpeg_size();
+        pdf_len = pdf_init(jpeg_len, jpeg_height(), _estack.sector_buf);
+    }
+    unsigned jpeg_blk = (jpeg_len - 1 + CLU_SECT * 512) / 512 & -CLU_SECT;
+    unsigned files = ((sizeof readme - 2 + CLU_SECT * 512) / 512 & -CLU_SECT)
+        + jpeg_blk + ((pdf_len - 1 + CLU_SECT * 512) / 512 & -CLU_SECT)
+        + ((png_len - 1 + CLU_SECT * 512) / 512 & -CLU_SECT);
+    unsigned nblk;
+
     // Initialise and mount filesystem.
     fs_stream_buf = _estack.stream_buf;
-    unsigned nblk = fs_init(&fs_param, cbd_num_sectors, true); // TODO: FS size
+    if (!cbd_num_sectors)
+        cbd_num_sectors = files;
+    while ((nblk = fs_init(&fs_param, cbd_num_sectors, true)) + files
+            > cbd_num_sectors)
+        cbd_num_sectors = nblk + files;
     f_mount(1, &fs);
 
     // Add readme.txt.
@@ -407,18 +462,19 @@ static void make_fs(void)
 
     // Set sizes in the USB device block map.
     cbd_map[CBD_ENTRY_FS].size = nblk;
-    cbd_map[CBD_ENTRY_JPEG].size = cbd_num_sectors - nblk;
+    cbd_map[CBD_ENTRY_JPEG].size = jpeg_blk;
+    cbd_map[CBD_ENTRY_PDF].size = png ? 0 : cbd_num_sectors - nblk - jpeg_blk;
+    cbd_map[CBD_ENTRY_PNG].size = png ? cbd_num_sectors - nblk : 0;
 
-    // Add JPEG file.
+    // Add JPEG and PDF files, whose clusters follow in that order, or the
+    // PNG file.
     char *buf = (char *) _estack.stream_buf + nblk * 512;
-    sprintf((char *)buf, "1:%s%.35s.jpg", prefix, texts[IDX_ADDRESS]);
-    f_open(&file, (char *)buf, FA_WRITE | FA_CREATE_ALWAYS);
-    FRESULT res = f_lseek(&file, (cbd_num_sectors - nblk) * 512);
-    if (res != FR_OK)
-        printf("f_lseek: %d\n", res);
-    res = f_close(&file);
-    if (res != FR_OK)
-        printf("f_close: %d\n", res);
+    if (png) {
+        add_file(&file, buf, "png", png_len);
+    } else {
+        add_file(&file, buf, "jpg", jpeg_len);
+        add_file(&file, buf, "pdf", pdf_len);
+    }
 
     // Unmount filesystem and register ownership.
     f_mount(1, 0);
@@ -432,6 +488,12 @@ static uint8_t * fs_get_block(unsigned blk)
     return write_ptr(blk);
 }
 
+// The filesystem blocks are all contiguous in the stream buffer.
+static uint8_t * fs_get_blocks(unsigned blk, unsigned *n)
+{
+    return fs_get_block(blk);
+}
+
 static uint8_t * esrc_get_block(unsigned blk)
 {
     // TODO: decrypt raw entropy from serial flash
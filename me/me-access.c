@@ -87,20 +87,36 @@ Ctrl_status me_usb_read_10(uint32_t addr, uint16_t nb_sector)
         return CTRL_FAIL;
 
     const struct CBD_map_entry * entry = cbd_map;
+    unsigned count = nb_sector;
 
-    while (addr >= entry->size)
-        addr -= entry++->size;
+    while (nb_sector) {
+        while (addr >= entry->size)
+            addr -= entry++->size;
 
-    for (; nb_sector; --nb_sector) {
-        uint8_t *blkptr = entry->get_block(addr++);
-        // udi_msc_trans_block() is limited to 64KB
-        if (!udi_msc_trans_block(true, blkptr, SECTOR_SIZE, 0))
+        // Send the longest run of sectors that is contiguous in memory.
+        // udi_msc_trans_block() is limited to 64KB.
+        unsigned n = entry->size - addr;
+        if (n > nb_sector)
+            n = nb_sector;
+        if (n > 0x10000 / SECTOR_SIZE)
+            n = 0x10000 / SECTOR_SIZE;
+
+        uint8_t *blkptr;
+        if (entry->get_blocks) {
+            blkptr = entry->get_blocks(addr, &n);
+        } else {
+            blkptr = entry->get_block(addr);
+            n = 1;
+        }
+        if (!udi_msc_trans_block(true, blkptr, n * SECTOR_SIZE, 0))
             return CTRL_FAIL;   // transfer aborted
-        if (addr >= entry->size)
-            addr -= entry++->size;
+        addr += n;
+        nb_sector -= n;
     }
-    if (entry->prefetchable)
-        entry->get_block(addr); // prefetch
+    if (addr >= entry->size)
+        addr -= entry++->size;
+    if (entry->read_ahead)
+        entry->read_ahead(addr, count);
 
     return CTRL_GOOD;
 }
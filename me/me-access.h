@@ -24,10 +24,15 @@
 #include <ctrl_access.h>
 
 // Structure defining fragments of the composite block device.
+// get_blocks is optional: it returns block blk like get_block, and reduces
+// *n to the number of blocks that follow it contiguously in memory.
+// read_ahead is optional too: it is called after a request for n blocks,
+// with the block that follows it.
 struct CBD_map_entry {
     unsigned  size;
     uint8_t * (*get_block)(unsigned blk);
-    bool prefetchable;
+    uint8_t * (*get_blocks)(unsigned blk, unsigned *n);
+    void (*read_ahead)(unsigned blk, unsigned n);
 };
 extern struct CBD_map_entry cbd_map[];
 extern unsigned cbd_num_sectors;
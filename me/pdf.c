@@ -0,0 +1,167 @@
+/*
+ * Single-page PDF wrapper around the streamed JPEG.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// File layout, in 512-byte blocks:
+//
+//  0           - header, catalog, page and its content stream, and the
+//                image dictionary, padded so that "stream\n" ends the block
+//  1 ...       - the JPEG stream, block for block
+//  last        - the end of the JPEG stream, "endstream", the xref table and
+//                the trailer, possibly spilling into one more block
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jpeg.h"
+#include "jpeg-data.h"
+#include "pdf.h"
+
+enum {
+    BLKSIZE     = 512,
+    DPI         = 220,      // resolution in the Exif header of jpeg_header
+    OBJECTS     = 5,        // catalog, pages, page, content, image
+};
+
+static unsigned jpeg_len;
+static unsigned jpeg_blocks;            // blocks with JPEG data, even partly
+static unsigned height;                 // in pixels
+static uint8_t *sector;
+static unsigned offsets[OBJECTS + 1];   // of each object, from 1
+static char trailer[224];               // from the end of the JPEG stream
+static unsigned trailer_len;
+
+// Convert pixels to hundredths of a point.
+static unsigned points(unsigned px)
+{
+    return (px * 7200 + DPI / 2) / DPI;
+}
+
+// Write block 0 into buf, and record the object offsets.
+static void make_header(char *buf)
+{
+    unsigned w = points(JWIDTH * 8), h = points(height);
+    char content[48], image[160];
+    int clen = sprintf(content, "q %u.%02u 0 0 %u.%02u 0 0 cm /Im0 Do Q\n",
+                       w / 100, w % 100, h / 100, h % 100);
+    int ilen = sprintf(image, "5 0 obj\n<< /Type /XObject /Subtype /Image "
+                       "/Width %u /Height %u\n/ColorSpace /DeviceGray "
+                       "/BitsPerComponent 8 /Filter /DCTDecode\n"
+                       "/Length %u >>\nstream\n",
+                       JWIDTH * 8, height, jpeg_len);
+    char *p = buf;
+
+    p += sprintf(p, "%%PDF-1.3\n%%\xE2\xE3\xCF\xD3\n");
+    offsets[1] = p - buf;
+    p += sprintf(p, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+    offsets[2] = p - buf;
+    p += sprintf(p, "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\n"
+                 "endobj\n");
+    offsets[3] = p - buf;
+    p += sprintf(p, "3 0 obj\n<< /Type /Page /Parent 2 0 R "
+                 "/MediaBox [0 0 %u.%02u %u.%02u]\n"
+                 "/Resources << /XObject << /Im0 5 0 R >> >> "
+                 "/Contents 4 0 R >>\nendobj\n",
+                 w / 100, w % 100, h / 100, h % 100);
+    offsets[4] = p - buf;
+    p += sprintf(p, "4 0 obj\n<< /Length %d >>\nstream\n%sendstream\n"
+                 "endobj\n", clen, content);
+
+    // pad with white space, so that the image stream starts the next block
+    offsets[5] = BLKSIZE - ilen;
+    assert(p <= buf + offsets[5]);
+    memset(p, ' ', buf + offsets[5] - p);
+    memcpy(buf + offsets[5], image, ilen);
+}
+
+unsigned pdf_init(unsigned len, unsigned rows, uint8_t *sector_buf)
+{
+    char *p = trailer;
+    int i;
+
+    jpeg_len = len;
+    jpeg_blocks = (len + BLKSIZE - 1) / BLKSIZE;
+    height = rows;
+    sector = sector_buf;
+
+    // the offsets are known once block 0 has been laid out
+    make_header((char *) sector);
+    p += sprintf(p, "\nendstream\nendobj\n");
+    unsigned xref = BLKSIZE + jpeg_len + (p - trailer);
+    p += sprintf(p, "xref\n0 %d\n0000000000 65535 f \n", OBJECTS + 1);
+    for (i = 1; i <= OBJECTS; i++)
+        p += sprintf(p, "%010u 00000 n \n", offsets[i]);
+    p += sprintf(p, "trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%u\n"
+                 "%%%%EOF\n", OBJECTS + 1, xref);
+    trailer_len = p - trailer;
+    assert(trailer_len <= sizeof trailer);
+
+    return BLKSIZE + jpeg_len + trailer_len;
+}
+
+// Assemble a block after the last full block of the JPEG stream.
+static uint8_t * tail_block(unsigned blk)
+{
+    unsigned start = blk * BLKSIZE, end = BLKSIZE + jpeg_len;
+    unsigned n = start < end ? end - start : 0;     // bytes of JPEG data
+    unsigned pos = start + n - end;                 // in the trailer
+
+    memset(sector, 0, BLKSIZE);
+    if (n)
+        memcpy(sector, jpeg_get_block(blk - 1), n);
+    if (pos < trailer_len) {
+        unsigned len = trailer_len - pos;
+        if (len > BLKSIZE - n)
+            len = BLKSIZE - n;
+        memcpy(sector + n, trailer + pos, len);
+    }
+    return sector;
+}
+
+uint8_t * pdf_get_block(unsigned blk)
+{
+    if (blk == 0) {
+        make_header((char *) sector);
+        return sector;
+    }
+    if (blk <= jpeg_len / BLKSIZE)
+        return jpeg_get_block(blk - 1);
+    return tail_block(blk);
+}
+
+// Runs of full JPEG blocks are as contiguous as jpeg_get_blocks() has them.
+uint8_t * pdf_get_blocks(unsigned blk, unsigned *n)
+{
+    unsigned full = jpeg_len / BLKSIZE;
+
+    if (blk == 0 || blk > full) {
+        *n = 1;
+        return pdf_get_block(blk);
+    }
+    if (*n > full + 1 - blk)
+        *n = full + 1 - blk;
+    return jpeg_get_blocks(blk - 1, n);
+}
+
+// A request from block 0 had one block less of the JPEG stream.
+void pdf_read_ahead(unsigned blk, unsigned n)
+{
+    if (blk && blk <= jpeg_blocks)
+        jpeg_read_ahead(blk - 1, n < blk ? n : blk - 1);
+}
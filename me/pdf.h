@@ -0,0 +1,39 @@
+/*
+ * Single-page PDF wrapper around the streamed JPEG.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef PDF_H_INCLUDED
+#define PDF_H_INCLUDED
+
+#include <stdint.h>
+
+// The PDF file holds the JPEG image as a /DCTDecode stream, printed at the
+// resolution of its Exif header.  Its first block holds all the objects up
+// to the start of the stream, so that the following blocks are those of
+// jpeg_get_block().  Only the block with the end of the image, followed by
+// the xref table, is assembled separately.
+
+// Set up the PDF for a JPEG image of jpeg_len bytes and the given height in
+// pixels.  Blocks that are not in the JPEG stream are built in sector_buf.
+// Return the size of the PDF file in bytes.
+unsigned pdf_init(unsigned jpeg_len, unsigned height, uint8_t *sector_buf);
+uint8_t * pdf_get_block(unsigned blk);
+uint8_t * pdf_get_blocks(unsigned blk, unsigned *n);
+void pdf_read_ahead(unsigned blk, unsigned n);
+
+#endif
@@ -0,0 +1,701 @@
+/*
+ * Streaming black and white PNG generator.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// The wallet image is black and white, but its pictures and fonts exist only
+// as JPEG bitstreams.  The PNG image is therefore made by decoding the JPEG
+// stream one macroblock row at a time, and thresholding the pixels at
+// mid-grey.  Blocks that have no AC coefficients, which is most of them,
+// need no IDCT.
+//
+// Each scanline is compressed on its own, with fixed Huffman codes and
+// matches of either the whole scanline above or runs of a repeated byte.
+// A white scanline takes 3 bytes.
+//
+// The output is kept in a ring of blocks, like the JPEG stream.  Blocks are
+// generated on demand; a request for a block that has left the ring resumes
+// from the last checkpoint before it, or starts the image again from the top.
+// The length of the IDAT chunk is only known at the end, so png_size() makes
+// the whole image once to learn it.
+
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jpeg.h"
+#include "jpeg-data.h"
+#include "png.h"
+
+enum {
+    BLKSIZE     = 512,
+    STRIDE      = JWIDTH + 1,   // bytes per scanline, with its filter type
+    MAX_PIECE   = BLKSIZE,      // more than any output of png_more()
+};
+
+// JPEG markers
+enum {
+    SOF0        = 0xC0,
+    DHT         = 0xC4,
+    DQT         = 0xDB,
+    DRI         = 0xDD,
+    SOS         = 0xDA,
+};
+
+// Tables from the JPEG header in flash.  They are the same for every image.
+static const uint8_t *dht_dc, *dht_ac;      // code counts, then symbols
+static const uint8_t *dqt;                  // in zigzag order
+
+static const uint8_t zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// IDCT basis in 4.12 fixed point: idct[x][u] = C(u)/2 cos((2x+1)u pi/16).
+static const int16_t idct[8][8] = {
+    { 1448,  2009,  1892,  1703,  1448,  1138,   784,   400 },
+    { 1448,  1703,   784,  -400, -1448, -2009, -1892, -1138 },
+    { 1448,  1138,  -784, -2009, -1448,   400,  1892,  1703 },
+    { 1448,   400, -1892, -1138,  1448,  1703,  -784, -2009 },
+    { 1448,  -400, -1892,  1138,  1448, -1703,  -784,  2009 },
+    { 1448, -1138,  -784,  2009, -1448,  -400,  1892, -1703 },
+    { 1448, -1703,   784,   400, -1448,  2009, -1892,  1138 },
+    { 1448, -2009,  1892, -1703,  1448, -1138,   784,  -400 },
+};
+
+// CRC-32 of PNG chunks, 4 bits at a time.
+static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+// Deflate length codes 257..285: base lengths and numbers of extra bits.
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+// Distance codes 0..15, enough for distances up to 256.
+static const uint16_t dist_base[16] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+};
+
+// Output ring.
+static struct {
+    uint8_t *buf, *end;         // ring of nblocks blocks
+    unsigned nblocks;
+    uint8_t *wp;                // write pointer
+    unsigned pos;               // bytes output so far
+    unsigned minblk;            // first block still in the ring
+    unsigned size;              // file size, once known
+    unsigned idat_len;          // IDAT length, once known
+    bool valid;                 // ring holds this image from minblk to pos
+    bool done;                  // up to the end
+} out;
+
+// Generator state.
+static struct {
+    // JPEG input
+    const uint8_t *src, *src_end;
+    unsigned src_blk;
+    unsigned bits, nbits;       // fewer than 8 bits left over
+    int pred;                   // DC prediction
+    unsigned interval;          // restart interval in macroblocks, or 0
+    unsigned mcus_left;         // before the next restart marker
+    // pixels
+    uint8_t (*rows)[JWIDTH];    // a macroblock row, 8 scanlines
+    uint8_t *prev;              // the scanline before them
+    unsigned height;            // in pixels
+    unsigned line;              // scanlines output so far
+    // PNG output
+    uint32_t acc;               // deflate bits, LSB first
+    unsigned nacc;
+    uint32_t adler_a, adler_b;
+    uint32_t crc;
+    unsigned idat_start;        // position of the zlib stream
+} g;
+
+// Checkpoints are taken at the start of a macroblock row whose scanline above
+// is white, so that the generator state is small: the positions in the JPEG
+// stream and the output, and the running checksums.  Like the JPEG
+// generator's, they are taken every checkpoint_interval blocks of output, and
+// every other one is dropped when they are full.  They live at the end of the
+// buffer.
+enum {
+    CHECKPOINTS         = 8,
+    CHECKPOINT_INTERVAL = 4,        // initial interval in blocks
+};
+struct checkpoint {
+    uint32_t pos;               // position in the output file
+    uint32_t crc;
+    uint16_t adler_a, adler_b;
+    uint16_t line;              // first scanline of the macroblock row
+    uint16_t src_blk;           // JPEG input
+    uint16_t src_off;
+    int16_t  pred;
+    uint16_t mcus_left;
+    uint8_t  bits, nbits;
+    uint8_t  acc, nacc;         // deflate bits not output yet
+};
+static struct checkpoint *checkpoints;  // in order of pos
+static unsigned num_checkpoints;
+static unsigned checkpoint_interval;
+
+static inline void out_byte(uint8_t c)
+{
+    g.crc ^= c;
+    g.crc = g.crc >> 4 ^ crc_table[g.crc & 15];
+    g.crc = g.crc >> 4 ^ crc_table[g.crc & 15];
+    *out.wp++ = c;
+    if (out.wp == out.end)
+        out.wp = out.buf;
+    out.pos++;
+}
+
+static void out_be32(uint32_t w)
+{
+    out_byte(w >> 24);
+    out_byte(w >> 16);
+    out_byte(w >> 8);
+    out_byte(w);
+}
+
+// Start a chunk of len bytes with the 4-character type.
+static void start_chunk(uint32_t len, const char *type)
+{
+    out_be32(len);
+    g.crc = ~0;
+    while (*type)
+        out_byte(*type++);
+}
+
+static void end_chunk(void)
+{
+    out_be32(~g.crc);
+}
+
+// Append n bits, LSB first.  Bits above n must be 0.
+static inline void put_bits(uint32_t bits, unsigned n)
+{
+    g.acc |= bits << g.nacc;
+    g.nacc += n;
+    while (g.nacc >= 8) {
+        out_byte(g.acc & 0xff);
+        g.acc >>= 8;
+        g.nacc -= 8;
+    }
+}
+
+// Append a Huffman code, which goes MSB first.
+static void put_code(unsigned code, unsigned len)
+{
+    unsigned rev = 0, i;
+
+    for (i = 0; i < len; i++, code >>= 1)
+        rev = rev << 1 | (code & 1);
+    put_bits(rev, len);
+}
+
+// Append a literal/length symbol with the fixed Huffman code.
+static void put_symbol(unsigned sym)
+{
+    if (sym < 144)
+        put_code(0x30 + sym, 8);
+    else if (sym < 256)
+        put_code(0x190 + sym - 144, 9);
+    else if (sym < 280)
+        put_code(sym - 256, 7);
+    else
+        put_code(0xc0 + sym - 280, 8);
+}
+
+static void put_match(unsigned len, unsigned dist)
+{
+    unsigned i;
+
+    for (i = 28; len_base[i] > len; i--)
+        ;
+    put_symbol(257 + i);
+    put_bits(len - len_base[i], len_extra[i]);
+
+    assert(dist <= 256);
+    for (i = 15; dist_base[i] > dist; i--)
+        ;
+    put_code(i, 5);
+    put_bits(dist - dist_base[i], i < 4 ? 0 : i / 2 - 1);
+}
+
+// Byte i of a scanline: the filter type (none), then the pixels.
+static inline unsigned sl(const uint8_t *row, unsigned i)
+{
+    return i ? row[i - 1] : 0;
+}
+
+// Compress scanline row, given the one before it (0 for the first).
+static void deflate_line(const uint8_t *row, const uint8_t *above)
+{
+    unsigned i, a = g.adler_a, b = g.adler_b;
+
+    for (i = 0; i < STRIDE; i++) {
+        a += sl(row, i);
+        b += a;
+    }
+    g.adler_a = a % 65521;
+    g.adler_b = b % 65521;
+
+    for (i = 0; i < STRIDE; ) {
+        unsigned up = 0, run = 0;
+
+        if (above)
+            while (i + up < STRIDE && sl(row, i + up) == sl(above, i + up))
+                up++;
+        if (i)
+            while (i + run < STRIDE && sl(row, i + run) == sl(row, i - 1))
+                run++;
+
+        if (up >= 3 && up >= run) {
+            put_match(up, STRIDE);
+            i += up;
+        } else if (run >= 3) {
+            put_match(run, 1);
+            i += run;
+        } else {
+            put_symbol(sl(row, i));
+            i++;
+        }
+    }
+}
+
+// Next byte of the JPEG stream.
+static unsigned src_byte(void)
+{
+    if (g.src == g.src_end) {
+        g.src = jpeg_get_block(++g.src_blk);
+        g.src_end = g.src + BLKSIZE;
+    }
+    return *g.src++;
+}
+
+static unsigned get_bit(void)
+{
+    if (!g.nbits) {
+        g.bits = src_byte();
+        if (g.bits == 0xff)
+            src_byte();     // stuffed 0
+        g.nbits = 8;
+    }
+    return g.bits >> --g.nbits & 1;
+}
+
+static int get_value(unsigned size)
+{
+    int v = 0;
+    unsigned i;
+
+    for (i = 0; i < size; i++)
+        v = v << 1 | get_bit();
+    if (size && v < 1 << (size - 1))
+        v -= (1 << size) - 1;
+    return v;
+}
+
+// Decode a symbol with a Huffman table as in a DHT segment.
+static unsigned get_huffman(const uint8_t *table)
+{
+    const uint8_t *symbols = table + 16;
+    unsigned c = 0, first = 0;
+    int l;
+
+    for (l = 0; l < 16; l++) {
+        c |= get_bit();
+        if (c - first < table[l])
+            return symbols[c - first];
+        symbols += table[l];
+        first = (first + table[l]) << 1;
+        c <<= 1;
+    }
+    assert(0);
+    return 0;
+}
+
+// Decode the next 8x8 block into 8 bytes of pixels, one per scanline,
+// 1 for white, at p, p + JWIDTH, etc.
+static void decode_block(uint8_t *p)
+{
+    int32_t coef[64], tmp[64];
+    unsigned k, x, y, u, v, rows = 0;
+
+    g.pred += get_value(get_huffman(dht_dc));
+    memset(coef, 0, sizeof coef);
+    coef[0] = g.pred * dqt[0];
+
+    for (k = 1; k < 64; k++) {
+        unsigned rs = get_huffman(dht_ac);
+        if (!(rs & 15)) {
+            if (rs != 0xf0)
+                break;      // end of block
+            k += 15;
+            continue;
+        }
+        k += rs >> 4;
+        coef[zigzag[k]] = get_value(rs & 15) * dqt[k];
+        rows |= 1 << (zigzag[k] >> 3);
+    }
+
+    if (!rows) {
+        // flat: white from mid-grey up
+        for (y = 0; y < 8; y++, p += JWIDTH)
+            *p = coef[0] >= 0 ? 0xff : 0;
+        return;
+    }
+
+    // rows of frequencies, then columns
+    rows |= 1;
+    for (v = 0; v < 8; v++) {
+        if (!(rows & 1 << v))
+            continue;
+        for (x = 0; x < 8; x++) {
+            int32_t s = 0;
+            for (u = 0; u < 8; u++)
+                s += idct[x][u] * coef[v * 8 + u];
+            tmp[v * 8 + x] = s >> 12;
+        }
+    }
+    for (y = 0; y < 8; y++, p += JWIDTH) {
+        unsigned bits = 0;
+        for (x = 0; x < 8; x++) {
+            int32_t s = 0;
+            for (v = 0; v < 8; v++)
+                if (rows & 1 << v)
+                    s += idct[y][v] * tmp[v * 8 + x];
+            bits = bits << 1 | (s >= 0);    // level shift of 128 ignored
+        }
+        *p = bits;
+    }
+}
+
+static void decode_row(void)
+{
+    unsigned bx;
+
+    for (bx = 0; bx < JWIDTH; bx++) {
+        if (g.interval && !g.mcus_left) {
+            // byte-aligned restart marker, and no DC prediction after it
+            g.nbits = 0;
+            src_byte();
+            src_byte();
+            g.pred = 0;
+            g.mcus_left = g.interval;
+        }
+        decode_block(&g.rows[0][bx]);
+        g.mcus_left--;
+    }
+}
+
+// Start the image from the top: read the JPEG header, and output the PNG
+// header up to the start of the deflate block.
+static void png_start(void)
+{
+    static const uint8_t signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    unsigned i, marker;
+
+    out.wp = out.buf;
+    out.pos = 0;
+    out.minblk = 0;
+    out.valid = true;
+    out.done = false;
+
+    g.src_blk = 0;
+    g.src = jpeg_get_block(0);
+    g.src_end = g.src + BLKSIZE;
+    g.src += 2;     // SOI
+    g.interval = 0;
+    do {
+        src_byte();
+        marker = src_byte();
+        unsigned len = src_byte() << 8;
+        len |= src_byte();
+        if (marker == SOF0) {
+            src_byte();
+            g.height = src_byte() << 8;
+            g.height |= src_byte();
+            len -= 3;
+        } else if (marker == DRI) {
+            g.interval = src_byte() << 8;
+            g.interval |= src_byte();
+            len -= 2;
+        }
+        for (len -= 2; len; len--)
+            src_byte();
+    } while (marker != SOS);
+    g.nbits = 0;
+    g.pred = 0;
+    g.mcus_left = g.interval;
+    g.line = 0;
+
+    g.acc = 0;
+    g.nacc = 0;
+    g.adler_a = 1;
+    g.adler_b = 0;
+
+    for (i = 0; i < sizeof signature; i++)
+        out_byte(signature[i]);
+    start_chunk(13, "IHDR");
+    out_be32(JWIDTH * 8);
+    out_be32(g.height);
+    out_byte(1);    // bit depth
+    out_byte(0);    // greyscale
+    out_byte(0);    // deflate
+    out_byte(0);    // adaptive filtering
+    out_byte(0);    // no interlace
+    end_chunk();
+    start_chunk(out.idat_len, "IDAT");
+    g.idat_start = out.pos;
+    out_byte(0x78); // deflate with a 32K window
+    out_byte(0x01); // fastest compression, and the check bits
+    put_bits(1, 1); // final block
+    put_bits(1, 2); // fixed Huffman codes
+}
+
+// Save the generator state at the start of a macroblock row if the output
+// has advanced far enough since the last checkpoint, and the scanline above
+// is white.
+static void save_checkpoint(void)
+{
+    unsigned last = num_checkpoints ? checkpoints[num_checkpoints - 1].pos : 0;
+    unsigned i;
+
+    if (out.pos < last + checkpoint_interval * BLKSIZE)
+        return;
+    for (i = 0; i < JWIDTH; i++)
+        if (g.rows[7][i] != 0xff)
+            return;
+
+    if (num_checkpoints == CHECKPOINTS) {
+        for (i = 1; i < CHECKPOINTS / 2; i++)
+            checkpoints[i] = checkpoints[2 * i];
+        num_checkpoints = CHECKPOINTS / 2;
+        checkpoint_interval *= 2;
+        if (out.pos < checkpoints[num_checkpoints - 1].pos
+                + checkpoint_interval * BLKSIZE)
+            return;
+    }
+
+    struct checkpoint *c = &checkpoints[num_checkpoints++];
+
+    c->pos = out.pos;
+    c->crc = g.crc;
+    c->adler_a = g.adler_a;
+    c->adler_b = g.adler_b;
+    c->line = g.line;
+    c->src_blk = g.src_blk;
+    c->src_off = BLKSIZE - (g.src_end - g.src);
+    c->pred = g.pred;
+    c->mcus_left = g.mcus_left;
+    c->bits = g.bits;
+    c->nbits = g.nbits;
+    c->acc = g.acc;
+    c->nacc = g.nacc;
+}
+
+// Find the last checkpoint from which block blk can be produced.
+static const struct checkpoint * find_checkpoint(unsigned blk)
+{
+    const struct checkpoint *c = 0;
+    unsigned i;
+
+    for (i = 0; i < num_checkpoints
+            && (checkpoints[i].pos + BLKSIZE - 1) / BLKSIZE <= blk; i++)
+        c = &checkpoints[i];
+    return c;
+}
+
+// Continue the image from a checkpoint.  The block it is in has lost its
+// beginning, and is no longer in the ring.
+static void png_resume(const struct checkpoint *c)
+{
+    out.wp = out.buf + c->pos % (out.nblocks * BLKSIZE);
+    out.pos = c->pos;
+    out.minblk = (c->pos + BLKSIZE - 1) / BLKSIZE;
+    out.valid = true;
+    out.done = false;
+
+    g.src_blk = c->src_blk;
+    g.src = jpeg_get_block(c->src_blk);
+    g.src_end = g.src + BLKSIZE;
+    g.src += c->src_off;
+    g.bits = c->bits;
+    g.nbits = c->nbits;
+    g.pred = c->pred;
+    g.mcus_left = c->mcus_left;
+    g.line = c->line;
+    memset(g.rows[7], 0xff, JWIDTH);
+
+    g.acc = c->acc;
+    g.nacc = c->nacc;
+    g.adler_a = c->adler_a;
+    g.adler_b = c->adler_b;
+    g.crc = c->crc;
+}
+
+// Output the next scanline, or the end of the image.
+static void png_more(void)
+{
+    if (g.line < g.height) {
+        unsigned y = g.line % 8;
+        if (!y) {
+            if (g.line) {
+                save_checkpoint();
+                memcpy(g.prev, g.rows[7], JWIDTH);
+            }
+            decode_row();
+        }
+        deflate_line(g.rows[y], y ? g.rows[y - 1] : g.line ? g.prev : 0);
+        g.line++;
+        return;
+    }
+
+    put_symbol(256);                // end of block
+    put_bits(0, -g.nacc & 7);
+    out_be32(g.adler_b << 16 | g.adler_a);
+    unsigned len = out.pos - g.idat_start;
+    end_chunk();
+    start_chunk(0, "IEND");
+    end_chunk();
+
+    out.done = true;
+    out.size = out.pos;
+    if (out.idat_len != len) {
+        // the header was written before the length was known
+        out.idat_len = len;
+        out.valid = false;
+    }
+}
+
+// Generate blocks up to blk + ahead, keeping block blk in the ring.
+static uint8_t * get_block(unsigned blk, unsigned ahead)
+{
+    const struct checkpoint *c = find_checkpoint(blk);
+
+    // Restart if the block is no longer in the ring, or skip ahead if there
+    // is a checkpoint beyond what we have generated so far.
+    if (!out.valid || blk < out.minblk
+            || (c && !out.done && c->pos > out.pos)) {
+        if (c)
+            png_resume(c);
+        else
+            png_start();
+    }
+
+    while (!out.done && out.pos < (blk + 1 + ahead) * BLKSIZE) {
+        while (out.pos + MAX_PIECE > (out.minblk + out.nblocks) * BLKSIZE)
+            out.minblk++;
+        assert(out.minblk <= blk);
+        png_more();
+    }
+    return out.buf + blk % out.nblocks * BLKSIZE;
+}
+
+void png_init(uint8_t *buf, uint8_t *end)
+{
+    const uint8_t *p = jpeg_header + 2;     // skip SOI
+
+    while (p[1] != SOS) {
+        unsigned len = p[2] << 8 | p[3];
+
+        if (p[1] == DHT) {
+            const uint8_t *t = p + 4;
+            while (t < p + 2 + len) {
+                unsigned n = 0, i;
+                for (i = 1; i <= 16; i++)
+                    n += t[i];
+                if (t[0] == 0x00)
+                    dht_dc = t + 1;     // class 0 (DC), table 0
+                else if (t[0] == 0x10)
+                    dht_ac = t + 1;     // class 1 (AC), table 0
+                t += 1 + 16 + n;
+            }
+        } else if (p[1] == DQT) {
+            dqt = p + 5;                // 8-bit table 0
+        }
+        p += 2 + len;
+    }
+    assert(dht_dc && dht_ac && dqt);
+
+    checkpoints = (struct checkpoint *) ((uintptr_t)
+            (end - CHECKPOINTS * sizeof *checkpoints)
+            & -__alignof__ (struct checkpoint));
+    num_checkpoints = 0;
+    checkpoint_interval = CHECKPOINT_INTERVAL;
+
+    g.rows = (uint8_t (*)[JWIDTH]) buf;
+    g.prev = buf + 8 * JWIDTH;
+    out.buf = g.prev + JWIDTH;
+    out.nblocks = ((uint8_t *) checkpoints - out.buf) / BLKSIZE;
+    out.end = out.buf + out.nblocks * BLKSIZE;
+    assert(out.nblocks >= 4);
+
+    out.size = 0;
+    out.idat_len = 0;
+    out.valid = false;
+}
+
+uint8_t * png_get_block(unsigned blk)
+{
+    png_size();
+    return get_block(blk, 0);
+}
+
+// Return block blk like png_get_block(), and through *n the number of
+// blocks from blk (at most *n) that follow it contiguously in the ring.
+uint8_t * png_get_blocks(unsigned blk, unsigned *n)
+{
+    png_size();
+
+    // the block after the run must fit in the ring too
+    unsigned ahead = *n < out.nblocks - 1 ? *n - 1 : out.nblocks - 2;
+    uint8_t *blk_ptr = get_block(blk, ahead);
+    unsigned end = out.done ? (out.pos + BLKSIZE - 1) / BLKSIZE
+                            : out.pos / BLKSIZE;
+    unsigned avail = end > blk ? end - blk : 1;
+
+    if (avail > out.nblocks - blk % out.nblocks)
+        avail = out.nblocks - blk % out.nblocks;
+    if (*n > avail)
+        *n = avail;
+    return blk_ptr;
+}
+
+// Return the exact size of the PNG file in bytes.  The first call makes the
+// whole image.
+unsigned png_size(void)
+{
+    unsigned blk = 0;
+
+    while (!out.size)
+        get_block(blk++, 0);
+    return out.size;
+}
@@ -0,0 +1,40 @@
+/*
+ * Streaming black and white PNG generator.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef PNG_H_INCLUDED
+#define PNG_H_INCLUDED
+
+#include <stdint.h>
+
+// The PNG image is made from the output of the JPEG generator, which must
+// have been set up with jpeg_init().  Each macroblock row is decoded and
+// turned into 1-bit pixels, which are compressed with fixed Huffman codes
+// into a single IDAT chunk.
+
+// Buffer for png_init(): the pixels of a macroblock row, the scanline before
+// them, a ring of 8 output blocks and the checkpoints.  JWIDTH is from
+// jpeg-data.h.
+#define PNG_BUF_SIZE    (9 * JWIDTH + 8 * 512 + 256)
+
+void png_init(uint8_t *buf, uint8_t *end);
+uint8_t * png_get_block(unsigned blk);
+uint8_t * png_get_blocks(unsigned blk, unsigned *n);
+unsigned png_size(void);
+
+#endif
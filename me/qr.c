@@ -30,28 +30,75 @@ enum {
     ECL_Q   = 3,
     ECL_H   = 2,
 
-    // mask: diagonal lines (fixed)
-    MASK    = 3,
+    // number of mask patterns
+    NUM_MASKS = 8,
 
-    // data encoding mode (we only use byte mode)
-    BYTE_MODE = 4,
+    // data encoding modes
+    NUMERIC_MODE = 1,
+    ALNUM_MODE   = 2,
+    BYTE_MODE    = 4,
 };
 
 static const unsigned raw_capacity[] = {
     QR3_RAW_BYTES, QR4_RAW_BYTES, QR5_RAW_BYTES, QR6_RAW_BYTES,
+    QR7_RAW_BYTES, QR8_RAW_BYTES, QR9_RAW_BYTES, QR10_RAW_BYTES,
 };
-static const uint8_t ecc_len[] = {
-    // ECC lengths for H, Q, M, L levels
-    RSLEN_3_H, RSLEN_3_Q, RSLEN_3_M, RSLEN_3_L,
-    RSLEN_4_H, RSLEN_4_Q, RSLEN_4_M, RSLEN_4_L,
-    RSLEN_5_H, RSLEN_5_Q, RSLEN_5_M, RSLEN_5_L,
-    RSLEN_6_H, RSLEN_6_Q, RSLEN_6_M, RSLEN_6_L,
+
+// Reed-Solomon blocks for H, Q, M, L levels: number of blocks and ECC
+// bytes in each.  The data is split evenly between the blocks, the last
+// ones taking one byte more where it does not divide.
+static const struct {
+    uint8_t blocks;
+    uint8_t ecc;
+} rs_blocks[][4] = {
+    { { 2, 22 }, { 2, 18 }, { 1, 26 }, { 1, 15 } },     // version 3
+    { { 4, 16 }, { 2, 26 }, { 2, 18 }, { 1, 20 } },
+    { { 4, 22 }, { 4, 18 }, { 2, 24 }, { 1, 26 } },
+    { { 4, 28 }, { 4, 24 }, { 4, 16 }, { 2, 18 } },
+    { { 5, 26 }, { 6, 18 }, { 4, 18 }, { 2, 20 } },
+    { { 6, 26 }, { 6, 22 }, { 4, 22 }, { 2, 24 } },
+    { { 8, 24 }, { 8, 20 }, { 5, 22 }, { 2, 30 } },
+    { { 8, 28 }, { 8, 24 }, { 5, 26 }, { 4, 18 } },     // version 10
 };
 
+// Characters of the alphanumeric mode, in the order of their values
+static const char alnum_chars[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+// Overwrite a pattern of n-bit rows at (x, y).
+static void draw_pattern(qr_row_t *qr, const uint8_t *rows, int n,
+                         int x, int y)
+{
+    qr_row_t m = (((qr_row_t)1 << n) - 1) << x;
+    int i;
+
+    for (i = 0; i < n; i++)
+        qr[y + i] = (qr[y + i] & ~m) | (qr_row_t)rows[i] << x;
+}
+
+// Draw the alignment patterns, whose centres are on all combinations of
+// rows and columns 6, the middle (from version 7) and size - 7, except
+// where they would overlap the finders.
+static void draw_alignment(qr_row_t *qr, const uint8_t *rows, int size)
+{
+    int pos[3] = { 6, (size - 1) / 2, size - 7 };
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            int middle = i == 1 || j == 1;
+            int finder = !middle && i * j == 0;
+            if (!finder && (!middle || size >= QR_SIZE(7)))
+                draw_pattern(qr, rows, 5, pos[j] - 2, pos[i] - 2);
+        }
+    }
+}
+
 // Fill all "modules" (pixels) belonging to fixed patterns with 1,
 // and all data modules with 0.
 static void fill_fixed_pattern_mask(qr_row_t *qr, int size)
 {
+    static const uint8_t alignment[5] = { 0x1f, 0x1f, 0x1f, 0x1f, 0x1f };
     qr_row_t p;
     int i;
 
@@ -60,122 +107,86 @@ static void fill_fixed_pattern_mask(qr_row_t *qr, int size)
     for (i = 0; i < 9; i++)
         qr[i] = p;
 
+    // vertical timing
+    for (; i < size; i++)
+        qr[i] = 1 << 6;
+
     // horizontal timing
     qr[6] = ((qr_row_t)1 << size) - 1;
 
-    // vertical timing
-    for (; i < size - 9; i++)
-        qr[i] = 1 << 6;
+    // bottom finder and format info
+    for (i = size - 8; i < size; i++)
+        qr[i] |= 0x1ff;
 
-    // alignment and bottom finder
-    p = 0x40 | (qr_row_t)0x1f << (size - 9);
-    for (; i < size - 4; i++) {
-        qr[i] = p;
-        p |= 0x1ff;
+    // version info
+    if (size >= QR_SIZE(7)) {
+        for (i = 0; i < 6; i++)
+            qr[i] |= (qr_row_t)7 << (size - 11);
+        for (i = size - 11; i < size - 8; i++)
+            qr[i] |= 0x3f;
     }
-    for (; i < size; i++)
-        qr[i] = 0x1ff;
+
+    draw_alignment(qr, alignment, size);
 }
 
-// Draw fixed patterns by selectively converting 1s in the mask to 0s
-// where the corresponding module is white.
-static void apply_fixed_patterns(qr_row_t *qr, int size)
+// Draw fixed patterns over the modules that are 1 in fixed, leaving the
+// format and version info white.
+static void apply_fixed_patterns(qr_row_t *qr, const qr_row_t *fixed,
+                                 int size)
 {
-    qr_row_t p;
+    static const uint8_t finder[7] = {
+        0x7f, 0x41, 0x5d, 0x5d, 0x5d, 0x41, 0x7f
+    };
+    static const uint8_t alignment[5] = { 0x1f, 0x11, 0x15, 0x11, 0x1f };
     int i;
 
-    // top finders
-    qr[0] ^= 0x180 | (qr_row_t)0x02 << (size - 9);
-    p = 0x1be | (qr_row_t)0xfa << (size - 9);
-    qr[1] ^= p;
-    qr[5] ^= p;
-    p = 0x1a2 | (qr_row_t)0x8a << (size - 9);
-    qr[2] ^= p;
-    qr[3] ^= p;
-    qr[4] ^= p;
+    for (i = 0; i < size; i++)
+        qr[i] &= ~fixed[i];
 
-    // horizontal timing
-    qr[6] ^= 0x2aaa80 | (qr_row_t)0x2aaa80 << (size - 29);
-
-    // format info
-    p = 0x1bf | (qr_row_t)0x1fe << (size - 9);
-    qr[7] ^= p | 0x40;
-    qr[8] ^= p;
+    // timing, every other module; the finders cover both ends
+    qr[6] |= (qr_row_t)0x5555555555555555 & (((qr_row_t)1 << size) - 1);
+    for (i = 0; i < size; i += 2)
+        qr[i] |= 1 << 6;
 
-    // vertical timing
-    for (i = 9; i < size - 9; i++)
-        qr[i] ^= (i & 1) << 6;
-
-    // alignment and bottom finder
-    qr[++i] ^= 0xff | (qr_row_t)0xe << (size - 9);
-    qr[++i] ^= 0x180 | (qr_row_t)0xa << (size - 9);
-    qr[++i] ^= 0x1be | (qr_row_t)0xe << (size - 9);
-    qr[++i] ^= 0x1a2;
-    qr[++i] ^= 0x1a2;
-    qr[++i] ^= 0x1a2;
-    qr[++i] ^= 0x1be;
-    qr[++i] ^= 0x180;
-}
+    draw_pattern(qr, finder, 7, 0, 0);
+    draw_pattern(qr, finder, 7, size - 7, 0);
+    draw_pattern(qr, finder, 7, 0, size - 7);
+    draw_alignment(qr, alignment, size);
 
-// bitstream feeder state and interleave parameters
-static uint8_t *msg_ptr;
-static int      msg_bit;
-static uint16_t msg_idx;
-static uint16_t msg_pitch;
-static uint8_t  msg_nparts;
-static uint8_t  msg_part;
-static uint8_t  msg_data_len;
-static uint8_t  msg_data_skip;
-
-static unsigned next_bit(void)
-{
-    static uint8_t byte;
-
-    if (--msg_bit < 0) {
-        msg_bit = 7;
-        byte = msg_ptr[msg_idx + msg_part * msg_pitch];
-        msg_part++;
-        while (msg_part == msg_nparts) {
-            msg_part = 0;
-            msg_idx++;
-            if (msg_idx == msg_data_len)
-                msg_part = msg_data_skip;
-            else
-                break;
-        }
-    }
-    return byte >> msg_bit & 1;
+    // the dark module next to the bottom finder
+    qr[size - 8] |= 1 << 8;
 }
 
-// Serialise data from msg_ptr as a bitstream and fit it over 0-bits in qr,
-// thus avoiding fixed patterns.
-static void fill_bitstream(qr_row_t *qr, int size)
+// Fit the codeword sequence seq as a bitstream over 0-bits in qr, thus
+// avoiding fixed patterns.  The data is left unmasked.
+static void fill_bitstream(qr_row_t *qr, int size, const uint8_t *seq)
 {
     int x = size - 1;
     int y = size - 1;
     int dir = -1;
-    qr_row_t rbit = (qr_row_t)1 << x;
-    qr_row_t lbit = rbit >> 1;
+    uint32_t bits = 0;                  // next bits, first one in bit 31
+    int nbits = 0;
 
     // start in the bottom right corner, going up
     do {
-        // Using just one of the eight possible inversion masks,
-        // 011: (x+y) % 3 == 0, compute (x+y) % 3 without division;
-        // actually, do it for the left position (x-1, y).
-        int mask = x + y - 1;
-        mask = (mask>>4) + (mask&15);
-        mask = (mask>>2) + (mask&3);
-        mask = (mask>>2) + (mask&3);
-        // This gives a result between 1 and 4 for all points except (0,0),
-        // but that one belongs to a fixed pattern and is not used for the
-        // bit stream.
-        // For the left position the masking condition is equivalent to
-        // mask == 3, and the right position is +1, so mask == 2.
-
-        if ((qr[y] & rbit) == 0)
-            qr[y] |= (qr_row_t)((mask == 2) ^ next_bit()) << x;
-        if ((qr[y] & lbit) == 0)
-            qr[y] |= (qr_row_t)((mask == 3) ^ next_bit()) << (x-1);
+        // free modules: bit 1 for column x, bit 0 for column x-1
+        unsigned free = ~qr[y] >> (x-1) & 3;
+
+        if (free) {
+            if (nbits < 2) {
+                bits |= (uint32_t)*seq++ << (24 - nbits);
+                nbits += 8;
+            }
+            if (free == 3) {
+                qr[y] |= (qr_row_t)(bits >> 30) << (x-1);
+                bits <<= 2;
+                nbits -= 2;
+            } else {
+                qr[y] |= (qr_row_t)(bits >> 31) << (x - (free & 1));
+                bits <<= 1;
+                nbits--;
+            }
+        }
 
         y += dir;
 
@@ -192,12 +203,137 @@ static void fill_bitstream(qr_row_t *qr, int size)
         x -= 2;
         if (x == 6)
             --x;
-        rbit = (qr_row_t)1 << x;
-        lbit = rbit >> 1;
     } while (x >= 0);
 }
 
-// Encode the format word with error correction.
+// Mask patterns, one row at a time.  All eight conditions depend only on
+// y % 12 and x % 6; bit k of mask_rows[mask][y % 12] is set if modules with
+// x % 6 == k are inverted in row y.
+static const uint8_t mask_rows[NUM_MASKS][12] = {
+    { 0x15, 0x2a, 0x15, 0x2a, 0x15, 0x2a, 0x15, 0x2a, 0x15, 0x2a, 0x15, 0x2a },
+    { 0x3f, 0x00, 0x3f, 0x00, 0x3f, 0x00, 0x3f, 0x00, 0x3f, 0x00, 0x3f, 0x00 },
+    { 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09 },
+    { 0x09, 0x24, 0x12, 0x09, 0x24, 0x12, 0x09, 0x24, 0x12, 0x09, 0x24, 0x12 },
+    { 0x07, 0x07, 0x38, 0x38, 0x07, 0x07, 0x38, 0x38, 0x07, 0x07, 0x38, 0x38 },
+    { 0x3f, 0x01, 0x09, 0x15, 0x09, 0x01, 0x3f, 0x01, 0x09, 0x15, 0x09, 0x01 },
+    { 0x3f, 0x07, 0x1b, 0x15, 0x2d, 0x31, 0x3f, 0x07, 0x1b, 0x15, 0x2d, 0x31 },
+    { 0x15, 0x38, 0x31, 0x2a, 0x07, 0x0e, 0x15, 0x38, 0x31, 0x2a, 0x07, 0x0e },
+};
+
+// Invert the data modules of qr (those that are 0 in fixed) according to
+// the mask pattern.
+static void apply_mask(unsigned mask, qr_row_t *qr, const qr_row_t *fixed,
+                       int size)
+{
+    qr_row_t cls[6] = { 0 };            // columns with x % 6 == k
+    int x, y, k;
+
+    for (x = 0; x < size; x++)
+        cls[x % 6] |= (qr_row_t)1 << x;
+
+    for (y = 0, k = 0; y < size; y++, k = k == 11 ? 0 : k + 1) {
+        unsigned bits = mask_rows[mask][k];
+        qr_row_t m = 0;
+        for (x = 0; bits; x++, bits >>= 1)
+            if (bits & 1)
+                m |= cls[x];
+        qr[y] ^= m & ~fixed[y];
+    }
+}
+
+static unsigned popcount(uint64_t w)
+{
+    return __builtin_popcountll(w);
+}
+
+// Score runs of five or more same-coloured modules; w has 1s in the
+// positions of one colour.  Each run scores 3 plus its length beyond 5.
+static unsigned run_penalty(uint64_t w)
+{
+    uint64_t w2 = w & w >> 1;
+    uint64_t w5 = w2 & w2 >> 2 & w >> 4;    // starts of 5 in a row
+
+    return popcount(w5) + 2 * popcount(w5 & ~(w5 << 1));
+}
+
+// Count finder-like patterns, 1:1:3:1:1 with 4 light modules on either
+// side, in row w; modules outside the symbol are light.
+static unsigned finder_penalty(uint64_t w, int size)
+{
+    uint64_t starts = ((uint64_t)1 << (size - 6)) - 1;
+    uint64_t before = starts, after = starts;
+    uint64_t padded = w << 4;
+    int k;
+
+    // left to right: 0000 1011101 and 1011101 0000, by the start of 1011101
+    for (k = 0; k < 11; k++) {
+        before &= (0x5d0 >> k & 1 ? padded : ~padded) >> k;
+        after &= (0x05d >> k & 1 ? w : ~w) >> k;
+    }
+    return popcount(before) + popcount(after);
+}
+
+// Compute the penalty score of a masked symbol as per ISO/IEC 18004:2006,
+// section 6.8.2.1, working on whole rows at a time; columns are handled
+// by combining vertically adjacent rows.
+static unsigned penalty(const qr_row_t *qr, int size)
+{
+    const uint64_t all = ((uint64_t)1 << size) - 1;
+    uint64_t dark5 = 0, light5 = 0;     // starts of vertical runs in row - 1
+    unsigned score = 0, dark = 0;
+    int y, k;
+
+    for (y = 0; y < size; y++) {
+        uint64_t r = qr[y], d5 = r, l5 = ~r & all;
+        dark += popcount(r);
+
+        // runs within the row
+        score += run_penalty(r) + run_penalty(~r & all);
+
+        // vertical runs starting in this row
+        if (y <= size - 5) {
+            for (k = 1; k < 5; k++) {
+                d5 &= qr[y + k];
+                l5 &= ~qr[y + k];
+            }
+            score += popcount(d5) + 2 * popcount(d5 & ~dark5);
+            score += popcount(l5) + 2 * popcount(l5 & ~light5);
+            dark5 = d5;
+            light5 = l5;
+        }
+
+        // 2x2 blocks of the same colour
+        if (y < size - 1) {
+            uint64_t same = ~(r ^ qr[y + 1]);
+            score += 3 * popcount(same & same >> 1 & ~(r ^ r >> 1) & all >> 1);
+        }
+
+        // finder-like patterns within the row
+        score += 40 * finder_penalty(r, size);
+    }
+
+    // finder-like patterns within the columns; rows outside the symbol
+    // are light
+    for (y = -4; y < size - 6; y++) {
+        uint64_t left = all, right = all;
+        for (k = 0; k < 11; k++) {
+            uint64_t r = y + k >= 0 && y + k < size ? qr[y + k] : 0;
+            left &= 0x5d0 >> k & 1 ? r : ~r;
+            right &= 0x05d >> k & 1 ? r : ~r;
+        }
+        score += 40 * (popcount(left) + popcount(right));
+    }
+
+    // proportion of dark modules: 10 points for each 5% deviation from 50%
+    k = 20 * (int)dark - 10 * size * size;
+    if (k < 0)
+        k = -k;
+    score += 10 * (k / (size * size));
+
+    return score;
+}
+
+// Encode the format or version word with error correction.
 static unsigned encode_format(unsigned fmt, unsigned poly, int degree)
 {
     unsigned h = 1 << degree;
@@ -239,78 +375,200 @@ static void insert_format(unsigned fmt, qr_row_t *qr, int size)
     }
 }
 
-// Generate QR code from msg.
-void qr_encode(const char *msg, qr_row_t *qr, int size)
+// Return the format word for EC level ecl and mask pattern mask.
+static unsigned format_word(unsigned ecl, unsigned mask)
+{
+    unsigned f = ecl << 3 | mask;               // five bits
+
+    f = f << 10 | encode_format(f, 0x537, 10);  // add 10 check bits
+    return f ^ 0x5412;                          // apply format mask
+}
+
+// Insert version information into the appropriate places in qr
+// (versions 7 and above).
+static void insert_version(int version, qr_row_t *qr, int size)
 {
+    unsigned v = version << 12 | encode_format(version, 0x1f25, 12);
     int i;
-    int c = strlen(msg);
-    int len;                            // length of data without EC
-    unsigned ecl;                       // EC level
-    unsigned f;
-    uint8_t buf[QR_MAX_RAW_BYTES + 5];  // 5 for gaps and remaining bits
-    uint8_t *bufp = buf;
-
-    // find highest EC level for the requested QR size with sufficient
-    // data capacity to hold msg + two bytes for mode and length;
-    // usable capacty = raw capacity - RS length - 2
-    f = raw_capacity[(size - 29) / 4];  // raw capacity in bytes
-    i = size - 29;
-    while (len = f - ecc_len[i], c > len - 2) {
-        i++;
-        assert(i != size - 25);         // don't go beyond the lowest ECL
+
+    for (i = 0; i < 18; i++) {
+        if (v >> i & 1) {
+            qr[i / 3] |= (qr_row_t)1 << (size - 11 + i % 3);
+            qr[size - 11 + i % 3] |= (qr_row_t)1 << (i / 3);
+        }
     }
-    ecl = (i & 3) ^ 2;                  // ECL encoding for the format byte
-
-    // compute the partitioning of data and ecc bytes
-    f -= len;           // ecc size
-    int n = 1;          // number of parts
-    while (f > 31) {
-        f >>= 1;
-        n <<= 1;
+}
+
+// Return the most compact mode that can encode all of msg.
+static unsigned data_mode(const char *msg)
+{
+    unsigned mode = NUMERIC_MODE;
+
+    for (; *msg; msg++) {
+        if (*msg < '0' || *msg > '9')
+            mode = ALNUM_MODE;
+        if (!strchr(alnum_chars, *msg))
+            return BYTE_MODE;
     }
+    return mode;
+}
 
-    rs_init(0x11d, f);
-
-    // tell the bit stream feeder about interleaving
-    msg_nparts = n;
-    msg_data_len = len / n;
-    msg_data_skip = n - len % n;
-    msg_pitch = msg_data_len + 1 + f;
-
-    // fill QR data buffer with message as follows:
-    // encoding mode (4 bits), length (8 bits for BYTE_MODE), message, 0000,
-    // then fill up the remaining space with zeros;
-    // do it one part at a time, appending error correction bytes to each part
-    len %= n;           // number of data parts that are 1 byte longer
-    c |= BYTE_MODE << 8;
-    do {                // for each part
-        for (i = 0; i < msg_data_len + (n <= len); i++) {
-            bufp[i] = c >> 4;
-            c = c << 8 | *msg;
-            if (*msg)
-                msg++;
+// Return the length of the character count for mode in version.
+static int count_bits(unsigned mode, int version)
+{
+    static const uint8_t bits[2][3] = {
+        { 10, 9, 8 },       // versions 1 to 9
+        { 12, 11, 16 },     // versions 10 to 26
+    };
+
+    return bits[version >= 10][mode >> 1];
+}
+
+// Return the number of data bits needed for len characters in mode,
+// including the mode indicator and character count.
+static unsigned data_bits(unsigned mode, int len, int version)
+{
+    static const uint8_t numeric_tail[3] = { 0, 4, 7 };
+    unsigned bits = 4 + count_bits(mode, version);
+
+    if (mode == NUMERIC_MODE)
+        return bits + len / 3 * 10 + numeric_tail[len % 3];
+    if (mode == ALNUM_MODE)
+        return bits + len / 2 * 11 + len % 2 * 6;
+    return bits + len * 8;
+}
+
+// Append the n low bits of value to buf at bit position *pos.
+static void put_bits(uint8_t *buf, unsigned *pos, unsigned value, int n)
+{
+    while (n--) {
+        if (value >> n & 1)
+            buf[*pos >> 3] |= 0x80 >> (*pos & 7);
+        ++*pos;
+    }
+}
+
+// Return the value of an alphanumeric character.
+static unsigned alnum_value(char c)
+{
+    return strchr(alnum_chars, c) - alnum_chars;
+}
+
+// Generate QR code from msg.
+void qr_encode(const char *msg, qr_row_t *qr, int size)
+{
+    int len = strlen(msg);
+    unsigned mode = data_mode(msg);
+    int version, level;                 // level: 0 to 3 for H, Q, M, L
+    int nblocks, ecc;                   // RS blocks and ECC bytes in each
+    int data_len, block_len, first_long;
+    int s;                              // symbol size
+    int i, b;
+    unsigned pos = 0;
+    uint8_t seq[QR_MAX_RAW_BYTES + 1];  // 1 for remaining bits
+    uint8_t *p;
+    struct RS_encoder rs;
+    qr_row_t fixed[QR_SIZE(QR_MAX_VERSION)];
+    union {
+        uint8_t  code[QR_MAX_RAW_BYTES];        // data, then ECC bytes
+        qr_row_t tmp[QR_SIZE(QR_MAX_VERSION)];  // symbol with a mask
+    } u;
+    unsigned mask, best_mask = 0, best_score = ~0u;
+
+    // find the highest EC level at which msg fits into size modules,
+    // then the smallest version with that level
+    for (level = 0, version = 3; ; version++) {
+        if (QR_SIZE(version) > size || version > QR_MAX_VERSION) {
+            level++;
+            version = 3;
+            assert(level < 4);          // don't go beyond the lowest ECL
+        }
+        nblocks = rs_blocks[version - 3][level].blocks;
+        ecc = rs_blocks[version - 3][level].ecc;
+        data_len = raw_capacity[version - 3] - nblocks * ecc;
+        if (data_bits(mode, len, version) <= data_len * 8u)
+            break;
+    }
+    s = QR_SIZE(version);
+
+    // data: mode (4 bits), character count, message, then zeros;
+    // zero bits also serve as the terminator
+    memset(u.code, 0, data_len);
+    put_bits(u.code, &pos, mode, 4);
+    put_bits(u.code, &pos, len, count_bits(mode, version));
+    for (i = 0; i < len; ) {
+        if (mode == NUMERIC_MODE) {
+            // 10 bits for 3 digits, 7 for 2 and 4 for 1
+            unsigned v = 0, n = 0;
+            for (; n < 3 && i < len; n++)
+                v = v * 10 + msg[i++] - '0';
+            put_bits(u.code, &pos, v, 3 * n + 1);
+        } else if (mode == ALNUM_MODE) {
+            // 11 bits for 2 characters and 6 for 1
+            unsigned v = alnum_value(msg[i++]);
+            if (i < len)
+                put_bits(u.code, &pos, v * 45 + alnum_value(msg[i++]), 11);
+            else
+                put_bits(u.code, &pos, v, 6);
+        } else {
+            put_bits(u.code, &pos, (uint8_t)msg[i++], 8);
         }
-        rs_encode(bufp, i, bufp + msg_data_len + 1);
-        bufp += msg_pitch;
-    } while (--n);
+    }
 
-    *bufp = 0;          // overflow bits
+    // error correction for each block
+    block_len = data_len / nblocks;
+    first_long = nblocks - data_len % nblocks;
+    rs_init(&rs, ecc);
+    for (b = 0, p = u.code; b < nblocks; b++) {
+        int n = block_len + (b >= first_long);
+        rs_encode(&rs, p, n, u.code + data_len + b * ecc);
+        p += n;
+    }
 
-    // initialise bit stream feeder and fill QR code
-    msg_ptr = buf;
-    msg_idx = 0;
-    msg_part = 0;
-    msg_bit = 0;
-    fill_fixed_pattern_mask(qr, size);
-    fill_bitstream(qr, size);
+    // interleave the blocks into the codeword sequence, byte i of each
+    // block in turn; the shorter blocks have no byte at block_len
+    p = seq;
+    for (i = 0; i <= block_len; i++)
+        for (b = i == block_len ? first_long : 0; b < nblocks; b++)
+            *p++ = u.code[b * block_len + (b > first_long ? b - first_long : 0)
+                          + i];
+    for (i = 0; i < ecc; i++)
+        for (b = 0; b < nblocks; b++)
+            *p++ = u.code[data_len + b * ecc + i];
+    *p = 0;             // remaining bits
+
+    // fill QR code
+    fill_fixed_pattern_mask(qr, s);
+    memcpy(fixed, qr, s * sizeof *qr);
+    fill_bitstream(qr, s, seq);
 
     // overlay fixed patterns
-    apply_fixed_patterns(qr, size);
+    apply_fixed_patterns(qr, fixed, s);
+    if (version >= 7)
+        insert_version(version, qr, s);
+
+    // try all masks with their format information, and keep the one with
+    // the lowest penalty
+    for (mask = 0; mask < NUM_MASKS; mask++) {
+        unsigned score;
+        memcpy(u.tmp, qr, s * sizeof *qr);
+        apply_mask(mask, u.tmp, fixed, s);
+        insert_format(format_word(level ^ 2, mask), u.tmp, s);
+        score = penalty(u.tmp, s);
+        if (score < best_score) {
+            best_score = score;
+            best_mask = mask;
+        }
+    }
 
-    // generate format information
-    f = ecl << 3 | MASK;                        // five bits
-    f = f << 10 | encode_format(f, 0x537, 10);  // add 10 check bits
-    f ^= 0x5412;                                // apply format mask
+    apply_mask(best_mask, qr, fixed, s);
+    insert_format(format_word(level ^ 2, best_mask), qr, s);
 
-    insert_format(f, qr, size);
+    // centre the symbol in the requested size, in a wider quiet zone
+    if (s < size) {
+        int offset = (size - s) / 2;
+        for (i = size - 1; i >= 0; i--)
+            qr[i] = i >= offset && i < offset + s ? qr[i - offset] << offset
+                                                  : 0;
+    }
 }
@@ -22,8 +22,8 @@
 
 #include <stdint.h>
 
-// Maximum QR "version" (size) that we support: 3 through to 6.
-#define QR_MAX_VERSION  6
+// Maximum QR "version" (size) that we support: 3 through to 10.
+#define QR_MAX_VERSION  10
 
 // Size in "modules" (dots) of QR code;
 // these should be surrounded by a "silent zone" four white (0) dots in width
@@ -37,32 +37,12 @@ enum {
     QR4_RAW_BYTES       = 100,      // size 33
     QR5_RAW_BYTES       = 134,      // size 37
     QR6_RAW_BYTES       = 172,      // size 41
+    QR7_RAW_BYTES       = 196,      // size 45
+    QR8_RAW_BYTES       = 242,      // size 49
+    QR9_RAW_BYTES       = 292,      // size 53
+    QR10_RAW_BYTES      = 346,      // size 57
 
     QR_MAX_RAW_BYTES    = QR_RAW_BYTES(QR_MAX_VERSION),
-
-    // Reed-Solomon EC lengths in bytes
-    RSLEN_3_L = 15,
-    RSLEN_3_M = 26,
-    RSLEN_3_Q = 36,
-    RSLEN_3_H = 44,
-    RSLEN_4_L = 20,
-    RSLEN_4_M = 36,
-    RSLEN_4_Q = 52,
-    RSLEN_4_H = 64,
-    RSLEN_5_L = 26,
-    RSLEN_5_M = 48,
-    RSLEN_5_Q = 72,
-    RSLEN_5_H = 88,
-    RSLEN_6_L = 36,
-    RSLEN_6_M = 64,
-    RSLEN_6_Q = 96,
-    RSLEN_6_H = 112,
-
-    // maximum message length for each version
-    QR3_MAX_LEN         = QR3_RAW_BYTES - RSLEN_3_L - 2,
-    QR4_MAX_LEN         = QR4_RAW_BYTES - RSLEN_4_L - 2,
-    QR5_MAX_LEN         = QR5_RAW_BYTES - RSLEN_5_L - 2,
-    QR6_MAX_LEN         = QR6_RAW_BYTES - RSLEN_6_L - 2,
 };
 
 #if QR_MAX_VERSION <= 3
@@ -71,7 +51,11 @@ typedef uint32_t qr_row_t;
 typedef uint64_t qr_row_t;
 #endif
 
-// Generate QR code from msg.
+// Generate QR code from msg, in numeric, alphanumeric or byte mode,
+// whichever is the most compact for all of msg.
+// The highest error correction level at which msg fits into size modules
+// is chosen, then the smallest version with that level; a smaller symbol
+// is centred in a wider quiet zone.
 // The result is written into qr, top to bottom, least significant bit on the
 // left hand side.  0 is white, 1 is black.
 void qr_encode(const char *msg, qr_row_t *qr, int size);
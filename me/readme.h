@@ -25,12 +25,14 @@ static const char readme[] =
 "A quick guide to your Mycelium Entropy device:\r\n"
 "\r\n"
 "1. Plug it in.\r\n"
-"2. For a 2-of-3 shared key, click the button while the LED is blinking rapidly.\r\n"
-"   To get a regular wallet, do nothing.\r\n"
+"2. For a 2-of-3 shared key (or as set in settings.txt), click the button\r\n"
+"   while the LED is blinking rapidly.  To get a regular wallet, do nothing.\r\n"
 "3. When rapid blinking has slowed down, your new wallet is ready.\r\n"
-"4. You will find a JPEG file with your new wallet; print it!\r\n"
+"4. You will find a JPEG file with your new wallet; print it!  The PDF file\r\n"
+"   holds the same image, and prints at its intended size.  (With the PNG\r\n"
+"   image format set in settings.txt, there is a PNG file instead.)\r\n"
 "\r\n"
-"To make more, click once for a regular wallet, or twice for a 2-of-3.\r\n"
+"To make more, click once for a regular wallet, or twice for a shared key.\r\n"
 "\r\n"
 "Please allow at least 7 seconds after unplugging your Mycelium Entropy\r\n"
 "before you plug it in again.\r\n"
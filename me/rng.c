@@ -32,6 +32,7 @@
 #include "lib/sha256.h"
 #include "lib/sha512.h"
 #include "rng.h"
+#include "health.h"
 
 #ifndef RNG_NO_FLASH
 #include "xflash.h"
@@ -97,6 +98,11 @@ enum {
 // End-of-transfer flag from the DMA controller's ADC RX channel.
 static volatile bool adc_done;
 
+// Continuous health tests on the raw TRNG words and ADC samples.
+// Any failure makes rng_health bad for good.
+static struct Health_test trng_test = HEALTH_TEST(TRNG_RCT_CUTOFF, TRNG_APT_CUTOFF);
+static struct Health_test adc_test = HEALTH_TEST(ADC_RCT_CUTOFF, ADC_APT_CUTOFF);
+
 #if RNG_DIAGNOSTICS
 static void diag_dump(const char *name, const void *data,
         int total_len, int sample_len)
@@ -170,18 +176,30 @@ bool rng_init(void)
     // Meanwhile, fill the temporary pool with the hash obtained above, and
     // with the data from hardware TRNG.
     memcpy(_estack.tmp.hash, state.hash, sizeof _estack.tmp.hash);
+    bool healthy = true;
     int i = TRNG_WORDS_FIRST;
     do {
-        if (TRNG->TRNG_ISR & TRNG_ISR_DATRDY)
-            _estack.tmp.trng[--i] = TRNG->TRNG_ODATA;
+        if (TRNG->TRNG_ISR & TRNG_ISR_DATRDY) {
+            uint32_t word = TRNG->TRNG_ODATA;
+            healthy &= health_sample(&trng_test, word);
+            _estack.tmp.trng[--i] = word;
+        }
     } while (i);
     TRNG->TRNG_CR = TRNG_CR_KEY(0x524E47);      // disable TRNG
 
     do ; while (!adc_done);
+    healthy &= health_bytes(&adc_test, _estack.tmp.adc, sizeof _estack.tmp.adc);
 
     // Finished with hardware entropy acquisition, return bus to normal speed.
     bus_clock(0);
 
+    if (!healthy) {
+        printf("Entropy source health test failed: TRNG %u/%u, ADC %u/%u.\n",
+                trng_test.rct_failures, trng_test.apt_failures,
+                adc_test.rct_failures, adc_test.apt_failures);
+        return false;
+    }
+
     diag_dump("TRNG output", _estack.tmp.trng, sizeof _estack.tmp.trng,
             sizeof _estack.tmp.trng);
     diag_dump("ADC data", _estack.tmp.adc, sizeof _estack.tmp.adc, 32);
@@ -224,16 +242,29 @@ void rng_next(uint32_t random_number[8])
 
         memcpy(mixer.hmac_key, state.hmac_key, sizeof mixer.hmac_key);
 
+        bool healthy = true;
         int i = TRNG_WORDS_NEXT;
         do {
-            if (TRNG->TRNG_ISR & TRNG_ISR_DATRDY)
-                mixer.trng[--i] = TRNG->TRNG_ODATA;
+            if (TRNG->TRNG_ISR & TRNG_ISR_DATRDY) {
+                uint32_t word = TRNG->TRNG_ODATA;
+                healthy &= health_sample(&trng_test, word);
+                mixer.trng[--i] = word;
+            }
         } while (i);
         TRNG->TRNG_CR = TRNG_CR_KEY(0x524E47);      // disable TRNG
 
         do ; while (!adc_done);
+        healthy &= health_bytes(&adc_test, mixer.adc, sizeof mixer.adc);
         bus_clock(0);
 
+        if (!healthy) {
+            rng_health = 0;
+            printf("Entropy source health test failed: TRNG %u/%u, ADC %u/%u.\n",
+                    trng_test.rct_failures, trng_test.apt_failures,
+                    adc_test.rct_failures, adc_test.apt_failures);
+            for (;;);
+        }
+
         diag_dump("TRNG output", mixer.trng, sizeof mixer.trng, sizeof mixer.trng);
         diag_dump("ADC data", mixer.adc, sizeof mixer.adc, 32);
 
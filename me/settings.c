@@ -54,6 +54,9 @@ int parse_settings(struct Raw_public_key keys[], int len)
     settings.salt_len = 0;
     settings.hd = false;
     settings.hd_path[0] = 0;
+    settings.sss_m = 2;
+    settings.sss_n = 3;
+    settings.image = IMAGE_JPEG;
 
     if (f_open(&file, "0:settings.txt", FA_READ) != FR_OK) {
         // probably no such file, revert to default configuration
@@ -79,6 +82,8 @@ int parse_settings(struct Raw_public_key keys[], int len)
         SIGN,
         SALT,
         HD,
+        SHAMIR,
+        IMAGE,
     };
 
     static const struct Token_table coin_args[] = {
@@ -92,13 +97,22 @@ int parse_settings(struct Raw_public_key keys[], int len)
         { .token = "ppc",       .code = COIN, .value = PEERCOIN },
         { 0 }
     };
+    static const struct Token_table image_args[] = {
+        { .token = "jpeg",      .code = IMAGE, .value = IMAGE_JPEG },
+        { .token = "jpg",       .code = IMAGE, .value = IMAGE_JPEG },
+        { .token = "png",       .code = IMAGE, .value = IMAGE_PNG },
+        { 0 }
+    };
+    enum { WITH_ARGS = 2 };    // commands that take a word from a table
     static const struct Token_table commands[] = {
         { .token = "coin",          .args = coin_args },
+        { .token = "image",         .args = image_args },
         { .token = "compressed",    .code = COMPRESS, .value = true },
         { .token = "uncompressed",  .code = COMPRESS, .value = false },
         { .token = "sign",          .code = SIGN },
         { .token = "salt1",         .code = SALT, .value = 1 },
         { .token = "hd",            .code = HD },
+        { .token = "shamir",        .code = SHAMIR },
         { 0 }
     };
     const struct Token_table *table = commands;
@@ -108,6 +122,7 @@ int parse_settings(struct Raw_public_key keys[], int len)
     bool in_hex = false;
     bool in_salt = false;
     int  in_hd = false;
+    bool in_shamir = false;
 
     f_read(&file, buf, sizeof buf, &num_chars_in_buf);
 
@@ -158,8 +173,26 @@ int parse_settings(struct Raw_public_key keys[], int len)
                         in_hd = false;
                         goto check_eol;
                     }
+                    if (in_shamir) {
+                        // M-of-N, with 2 <= M <= N <= 15
+                        unsigned m = 0, n = 0;
+                        char *t = token;
+                        while (*t >= '0' && *t <= '9')
+                            m = m * 10 + *t++ - '0';
+                        if (strncmp(t, "-of-", 4) != 0)
+                            return -2;
+                        for (t += 4; *t >= '0' && *t <= '9'; t++)
+                            n = n * 10 + *t - '0';
+                        if (*t || m < 2 || m > n || n > 15)
+                            return -2;
+                        settings.sss_m = m;
+                        settings.sss_n = n;
+                        in_shamir = false;
+                        goto check_eol;
+                    }
                     if (!table)
                         return -2;  // unexpected token
+                    bool command = table == commands;
                     while (strcmp(token, table->token) != 0) {
                         table++;
                         if (!table->token)
@@ -167,7 +200,7 @@ int parse_settings(struct Raw_public_key keys[], int len)
                     }
 
                     // process token
-                    if (table == commands)
+                    if (command && table < commands + WITH_ARGS)
                         table = table->args;
                     else {
                         switch (table->code) {
@@ -194,13 +227,19 @@ int parse_settings(struct Raw_public_key keys[], int len)
                             in_hd = true;
                             settings.hd = true;
                             break;
+                        case SHAMIR:
+                            in_shamir = true;
+                            break;
+                        case IMAGE:
+                            settings.image = table->value;
+                            break;
                         }
                         table = 0;  // no more tokens expected in this line
                     }
                 }
 check_eol:
                 if (c == '\n') {
-                    if (table && table != commands)
+                    if ((table && table != commands) || in_shamir)
                         return -2;  // EOL while expecting a token
                     table = commands;
                     in_hd = false;
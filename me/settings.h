@@ -41,8 +41,17 @@ extern struct Settings {
     uint8_t salt[32];
     bool    hd;
     char    hd_path[32];
+    uint8_t sss_m;          // Shamir's threshold: shares needed for the key
+    uint8_t sss_n;          // Shamir's total number of shares
+    uint8_t image;          // image file format, see below
 } settings;
 
+// Image file formats for settings.image.
+enum {
+    IMAGE_JPEG,             // JPEG file, and the same wrapped in a PDF file
+    IMAGE_PNG,              // black and white PNG file
+};
+
 // Coin types for settings.coin.
 // The first byte is avb, followed by bip44.
 #if __BYTE_ORDER == __LITTLE_ENDIAN
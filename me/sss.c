@@ -19,7 +19,11 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 #include "lib/rs.h"
 #include "lib/base58.h"
@@ -29,16 +33,36 @@
 #include "sss.h"
 
 
-// We can temporarily use the memory at _estack for coefficients.
-extern uint32_t _estack[];
-#define COEFF ((const uint8_t *)_estack)
+// The secret being shared, kept for making its shares one at a time.
+static struct {
+    uint8_t stype;
+    uint8_t id[2];
+    uint8_t m, n;
+    uint8_t len;
+    uint8_t secret[SSS_MAX_SECRET_SIZE + 1];    // zero-padded
+} sss;
 
 void sss_encode(int m, int n, uint8_t stype, const uint8_t secret[], int len)
 {
+    uint32_t hash[8];
+
     assert(n > 0 && n < 16);
     assert(m > 0 && m <= n);
     assert(len <= SSS_MAX_SECRET_SIZE);
 
+    sha256_twice(hash, secret, len);
+    sss.stype = stype;
+    sss.id[0] = ((const uint8_t *) hash)[0];
+    sss.id[1] = ((const uint8_t *) hash)[1];
+    sss.m = m;
+    sss.n = n;
+    sss.len = len;
+    memset(sss.secret, 0, sizeof sss.secret);
+    memcpy(sss.secret, secret, len);
+}
+
+void sss_share(unsigned x)
+{
     struct Share {
         uint8_t stype;
         uint8_t id[2];
@@ -46,13 +70,17 @@ void sss_encode(int m, int n, uint8_t stype, const uint8_t secret[], int len)
         uint8_t y[SSS_MAX_SECRET_SIZE];
     } share;
 
-    int x, i, j;
+    uint32_t coeff[2][8];       // current and next block of coefficients
+    int len = sss.len, blk = 0, used = 0, i, j;
+    unsigned xpow = 0;          // log(x**i), starting from i = 0
+    unsigned logx = gf_log[x];
 
-    sha256_twice(_estack, secret, len);
-    share.id[0] = COEFF[0];
-    share.id[1] = COEFF[1];
-    share.stype = stype;
-    share.m_and_x = (m - 1) << 4;
+    assert(x > 0 && x <= sss.n);
+
+    share.stype = sss.stype;
+    share.id[0] = sss.id[0];
+    share.id[1] = sss.id[1];
+    share.m_and_x = (sss.m - 1) << 4 | (x - 1);
 
     // Make pseudo-random coefficients, which should be unpredictable to
     // anyone who doesn't know the secret.
@@ -60,38 +88,117 @@ void sss_encode(int m, int n, uint8_t stype, const uint8_t secret[], int len)
     // for computing deterministic coefficients, although it looks a bit
     // similar.  The results of hashing are treated as if they are already
     // in logarithmic form.
-    // We need m - 1 coefficients of len bytes each.
-    sha256_hash(_estack, secret, len + 1);
-    for (i = SHA256_SIZE; i < len * (m - 1); i += SHA256_SIZE)
-        sha256_hash(&_estack[i / 4], &COEFF[i - SHA256_SIZE], SHA256_SIZE);
-
-    for (x = 1; x <= n; x++) {
-        unsigned xpow = 0;          // log(x**i), starting from i = 0
-        unsigned logx = rs.log[x];
-        const uint8_t *cptr = COEFF;
-
-        memcpy(share.y, secret, len);  // start with y = a0
-
-        for (i = 1; i < m; i++) {
-            xpow += logx;           // update xpow = log(x**i)
-            if (xpow >= 255)
-               xpow -= 255;         // modulo 255
-            // multiply i-th coefficient by x**i and add to share.y in GF
-            for (j = 0; j < len; j++) {
-                unsigned c = *cptr++;
-                if (c != INFTY) {
-                    c += xpow;
-                    if (c >= 255)
-                        c -= 255;
-                }
-                share.y[j] ^= rs.exp[c];
+    // We need m - 1 coefficients of len bytes each.  They are hashed one
+    // block at a time as they are used, so that every share gets the same
+    // ones without keeping them all.
+    sha256_hash(coeff[0], sss.secret, len + 1);
+
+    memcpy(share.y, sss.secret, len);  // start with y = a0
+
+    for (i = 1; i < sss.m; i++) {
+        xpow += logx;           // update xpow = log(x**i)
+        if (xpow >= 255)
+           xpow -= 255;         // modulo 255
+        // multiply i-th coefficient by x**i and add to share.y in GF
+        for (j = 0; j < len; j++) {
+            if (used == SHA256_SIZE) {
+                sha256_hash(coeff[!blk], (const uint8_t *) coeff[blk],
+                            SHA256_SIZE);
+                blk = !blk;
+                used = 0;
             }
+            unsigned c = ((const uint8_t *) coeff[blk])[used++];
+            if (c != INFTY) {
+                c += xpow;
+                if (c >= 255)
+                    c -= 255;
+            }
+            share.y[j] ^= gf_exp[c];
+        }
+    }
+
+    strcpy(texts[IDX_SSS_SHARE], "SSS-");
+    base58check_encode(&share.stype, len + offsetof(struct Share, y),
+                       texts[IDX_SSS_SHARE] + 4);
+    sprintf(texts[IDX_SSS_LABEL], "share %u/%d", x, sss.n);
+    sprintf(texts[IDX_SSS_THRESHOLD], "any %d shares reveal", sss.m);
+}
+
+// Add c * y[] to out[] in GF(2^8), len bytes; logc is log(c).
+static void gf_mul_add(uint8_t out[], const uint8_t y[], unsigned logc,
+                       int len)
+{
+#ifdef __SSSE3__
+    // On hosts, multiply 16 bytes at a time by looking up the products of
+    // their low and high nibbles with PSHUFB.
+    uint8_t lo[16], hi[16];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        lo[i] = i ? gf_exp[(gf_log[i] + logc) % 255] : 0;
+        hi[i] = i ? gf_exp[(gf_log[i << 4] + logc) % 255] : 0;
+    }
+
+    __m128i tlo = _mm_loadu_si128((const __m128i *) lo);
+    __m128i thi = _mm_loadu_si128((const __m128i *) hi);
+    __m128i nibble = _mm_set1_epi8(0x0f);
+
+    for (; len >= 16; len -= 16, y += 16, out += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) y);
+        __m128i p = _mm_xor_si128(
+                _mm_shuffle_epi8(tlo, _mm_and_si128(v, nibble)),
+                _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi16(v, 4),
+                                                    nibble)));
+        _mm_storeu_si128((__m128i *) out,
+                         _mm_xor_si128(_mm_loadu_si128((__m128i *) out), p));
+    }
+#endif
+
+    for (; len > 0; len--, out++) {
+        unsigned c = *y++;
+        if (c) {
+            c = gf_log[c] + logc;
+            if (c >= 255)
+                c -= 255;
+            *out ^= gf_exp[c];
         }
+    }
+}
+
+int sss_decode(const uint8_t *const shares[], int count, int len,
+               uint8_t secret[])
+{
+    const uint8_t *first = shares[0];
+    int m = (first[3] >> 4) + 1;
+    int i, j;
 
-        strcpy(texts[IDX_SSS_PART(x)], "SSS-");
-        base58check_encode(&share.stype, len + offsetof(struct Share, y),
-                           texts[IDX_SSS_PART(x)] + 4);
+    if (count < m || len <= 4 || len > 4 + SSS_MAX_SECRET_SIZE)
+        return -1;
 
-        share.m_and_x++;
+    for (i = 0; i < m; i++) {
+        if (memcmp(shares[i], first, 3) != 0
+                || (shares[i][3] ^ first[3]) >> 4 != 0)
+            return -1;
+        for (j = 0; j < i; j++)
+            if (shares[j][3] == shares[i][3])
+                return -1;
     }
+
+    // Interpolate the polynomial at 0 using the first m shares:
+    // secret = sum of y[i] * l[i], where the Lagrange coefficients
+    // l[i] = product over j != i of x[j] / (x[i] - x[j]),
+    // and subtraction is XOR.  The coefficients are computed as logarithms.
+    memset(secret, 0, len - 4);
+    for (i = 0; i < m; i++) {
+        unsigned xi = (shares[i][3] & 15) + 1;
+        unsigned logl = 0;
+        for (j = 0; j < m; j++) {
+            unsigned xj = (shares[j][3] & 15) + 1;
+            if (j != i)
+                logl += gf_log[xj] + 255 - gf_log[xi ^ xj];
+        }
+        gf_mul_add(secret, shares[i] + 4, logl % 255, len - 4);
+    }
+
+    return len - 4;
 }
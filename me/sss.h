@@ -36,11 +36,23 @@ enum {
     SSS_BASE58      = 19,
 };
 
-// Split secret into n shares, of which m shares are required to recover the
-// secret.  Encode the resulting shares in base-58.
-// 1 ≤ thr ≤ n ≤ 16.
+// Prepare to split secret into n shares, of which m shares are required to
+// recover the secret.  The shares are made one at a time by sss_share().
+// 1 ≤ m ≤ n ≤ 15.
 // stype is one of SSS_... above.
-// Write encoded shares into the global 'texts' array.
 void sss_encode(int m, int n, uint8_t stype, const uint8_t secret[], int len);
 
+// Make share x, 1 ≤ x ≤ n, of the secret given to sss_encode().
+// Write it in base-58 into texts[IDX_SSS_SHARE], and its number and the
+// threshold into texts[IDX_SSS_LABEL] and texts[IDX_SSS_THRESHOLD].
+void sss_share(unsigned x);
+
+// Recover the secret from count shares, each given as len bytes of decoded
+// Base58Check data: content type, ID, threshold and x, then y.
+// The first threshold shares are used.
+// Store the secret into secret[] and return its length, or return -1 if
+// there are not enough shares, they belong to different sets or repeat x.
+int sss_decode(const uint8_t *const shares[], int count, int len,
+               uint8_t secret[]);
+
 #endif
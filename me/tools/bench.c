@@ -0,0 +1,149 @@
+/*
+ * Benchmark of the JPEG bitstream writer.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Usage: bench [seconds]
+//
+// Renders picture rows, QR code rows and text rows into a memory buffer
+// and prints the output rate of each, then the time taken to encode a QR
+// code of each supported size.  The generator is included rather
+// than linked, so that its renderers can be called directly.
+
+#include <time.h>
+#include <stdlib.h>
+
+#include "jpeg.c"
+#include "settings.h"
+
+struct Settings settings;
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t out[1 << 16];
+
+// Render whole fragments with render() until the time is up.
+// Return the output rate in MB/s.
+static double run(void (*setup)(union fgm_state *), int total_width,
+                  bool (*render)(union fgm_state *, int), double seconds)
+{
+    union fgm_state state;
+    unsigned long long bytes = 0;
+    double start = now(), t;
+
+    do {
+        int i;
+        for (i = 0; i < 100; i++) {
+            jpeg.buf = out;
+            jpeg.leftover_bits = 0;
+            jpeg.num_leftover_bits = 0;
+            setup(&state);
+            while (render(&state, total_width))
+                ;
+            bytes += jpeg.buf - out;
+        }
+        t = now() - start;
+    } while (t < seconds);
+
+    return bytes / t * 1e-6;
+}
+
+static void setup_pic(union fgm_state *state)
+{
+    const uint16_t *pic = logo_middle_fragment;
+
+    state->pic.addr = pic[0] | pic[1] << 16;
+    state->pic.rows_left = pic[2] & 0xff;
+    state->pic.width = pic[2] >> 8;
+    state->pic.ptr = pic + 3;
+}
+
+static qr_row_t qr[QR_SIZE(QR_MAX_VERSION)];
+
+static void setup_qr(union fgm_state *state)
+{
+    state->qr.row = 0;
+    state->qr.size = QR_SIZE(4);
+    memcpy(state->qr.qr, qr, sizeof qr);
+}
+
+static const char text[] = "5KYZdUEo39z3FPrtuX2QbbwGnNP5zTd7yyr2SC1j299sBCnWjss";
+
+static void setup_text(union fgm_state *state)
+{
+    state->text.row = 0;
+    state->text.width = 51;
+    state->text.text = text;
+}
+
+// Encode QR codes of the given version until the time is up, with
+// a message of 3/5 of the raw capacity, which needs that version at level M.
+// Return the time per code in microseconds.
+static double run_encode(int version, double seconds)
+{
+    static const unsigned raw_bytes[] = {
+        QR3_RAW_BYTES, QR4_RAW_BYTES, QR5_RAW_BYTES, QR6_RAW_BYTES,
+        QR7_RAW_BYTES, QR8_RAW_BYTES, QR9_RAW_BYTES, QR10_RAW_BYTES,
+    };
+    char msg[QR_MAX_RAW_BYTES];
+    unsigned len = raw_bytes[version - 3] * 3 / 5, k;
+    unsigned long n = 0;
+    double start, t;
+
+    for (k = 0; k < len; k++)
+        msg[k] = text[k % (sizeof text - 1)];
+    msg[len] = 0;
+
+    start = now();
+    do {
+        int i;
+        for (i = 0; i < 100; i++)
+            qr_encode(msg, qr, QR_SIZE(version));
+        n += i;
+        t = now() - start;
+    } while (t < seconds);
+
+    return t / n * 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1;
+
+    jpeg_init(out, out + sizeof out, main_layout);
+    qr_encode(text, qr, QR_SIZE(4));
+
+    printf("picture rows: %7.1f MB/s\n", run(setup_pic,
+                LOGO_MIDDLE_FRAGMENT_WIDTH, render_pic, seconds));
+    printf("QR code rows: %7.1f MB/s\n", run(setup_qr,
+                QR_SIZE(4) + 1, render_qr, seconds));
+    printf("text rows:    %7.1f MB/s\n", run(setup_text,
+                sizeof text * CHR_WIDTH, render_text, seconds));
+
+    int v;
+    for (v = 3; v <= QR_MAX_VERSION; v++)
+        printf("QR encode %d: %7.1f us\n", QR_SIZE(v),
+               run_encode(v, seconds));
+
+    return 0;
+}
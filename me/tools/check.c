@@ -18,16 +18,19 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "ff.h"
-#include "lib/rs.h"
 #include "lib/hex.h"
 #include "data.h"
 #include "jpeg.h"
 #include "jpeg-data.h"
+#include "pdf.h"
+#include "png.h"
 #include "keygen.h"
 #include "sss.h"
 #include "settings.h"
@@ -36,8 +39,7 @@
 //void jpeg_dump(void);
 
 // Unallocated memory starts at the _estack symbol, provided by the linker to
-// the embedded firmware.  sss.c temporarily uses this area for coefficients,
-// and hd.c for the word list.
+// the embedded firmware.  hd.c temporarily uses this area for the word list.
 // Here we simulate _estack.
 uint32_t _estack[5 * 2048 / 4];
 
@@ -73,21 +75,166 @@ static int get_random_extent(int *xend, int nblk)
     return start;
 }
 
+// Simulate a USB mass storage host reading nblk blocks with READ(10)
+// commands of up to 64KB, served the way me_usb_read_10() does.  With runs,
+// each transfer is as long as jpeg_get_blocks() allows; otherwise each
+// sector is a separate transfer.  Return the number of transfers.
+static unsigned msc_read(uint8_t (*out)[512], unsigned nblk, bool runs)
+{
+    unsigned transfers = 0, blk = 0;
+
+    while (blk < nblk) {
+        unsigned nb_sector = nblk - blk < 128 ? nblk - blk : 128;
+        unsigned count = nb_sector;
+        while (nb_sector) {
+            unsigned n = nb_sector;
+            uint8_t *bptr = runs ? jpeg_get_blocks(blk, &n)
+                                 : jpeg_get_block(blk);
+            if (!runs)
+                n = 1;
+            memcpy(out[blk], bptr, n * 512);
+            transfers++;
+            blk += n;
+            nb_sector -= n;
+        }
+        jpeg_read_ahead(blk, count);
+    }
+    return transfers;
+}
+
 static bool check_layout(const struct Layout *layout, const char *name)
 {
-    unsigned height = 0;
-
-    do {
-        // skip fragments whose condition is false
-        while (layout_conditions[layout->cond_idx] != layout->cond_val)
-            layout++;
-        height += layout->vstep;
-    } while (layout++->type != FGM_STOP);
-
-    if (height != JHEIGHT)
-        printf("%s layout error: height %u, must be %d.\n", name, height,
-                JHEIGHT);
-    return height == JHEIGHT;
+    struct Layout_cmd cmd[LAYOUT_MAX_COMMANDS];
+    unsigned n = layout_compile(layout, cmd, LAYOUT_MAX_COMMANDS), i;
+    unsigned height = n ? cmd[n - 1].row : 0;
+    bool ok = n != 0;
+
+    if (!ok)
+        printf("%s layout error: more than %d items.\n", name,
+                LAYOUT_MAX_COMMANDS);
+    for (i = 0; i < n; i++) {
+        if (i && cmd[i].row < cmd[i - 1].row) {
+            printf("%s layout error: item %u goes up from row %u to %u.\n",
+                    name, i, cmd[i - 1].row, cmd[i].row);
+            ok = false;
+        }
+        if (cmd[i].type != FGM_STOP && cmd[i].type != FGM_LARGE_PICTURE
+                && cmd[i].type != FGM_REPEAT
+                && (cmd[i].x == 0 || cmd[i].x >= JWIDTH)) {
+            // fragments expect to start after white
+            printf("%s layout error: item %u at x %u.\n", name, i,
+                    cmd[i].x);
+            ok = false;
+        }
+        // layouts with pages must fit three pages, for 2-of-3 shares
+        if (cmd[i].type == FGM_REPEAT)
+            height += 2 * (cmd[i].row + cmd[i].item->repeat.gap - cmd[0].row);
+    }
+    if (n && height != JHEIGHT) {
+        printf("%s layout error: height %u, must be %d.\n", name,
+                height, JHEIGHT);
+        ok = false;
+    }
+    return ok;
+}
+
+// Write the PDF file for the image in jpeg_name, reading the PDF in runs of
+// blocks, and check that its stream holds the same bytes as the image.
+static int write_pdf(char *jpeg_name)
+{
+    static uint8_t sector[512];
+    unsigned jpeg_len = jpeg_size();
+    unsigned size = pdf_init(jpeg_len, jpeg_height(), sector);
+    unsigned n = (size + 511) / 512, blk, run;
+    uint8_t (*out)[512] = malloc(n * 512);
+    uint8_t *jpeg = malloc(jpeg_len);
+    int retcode = 0;
+
+    if (!out || !jpeg) {
+        fputs("Out of memory.\n", stderr);
+        return 1;
+    }
+    for (blk = 0; blk < n; blk += run) {
+        run = n - blk < 128 ? n - blk : 128;
+        uint8_t *bptr = pdf_get_blocks(blk, &run);
+        memcpy(out[blk], bptr, run * 512);
+        pdf_read_ahead(blk + run, run);
+    }
+
+    FILE *f = fopen(jpeg_name, "rb");
+    if (!f || fread(jpeg, 1, jpeg_len, f) != jpeg_len) {
+        perror(jpeg_name);
+        return 3;
+    }
+    fclose(f);
+    if (memcmp(out[1], jpeg, jpeg_len) != 0) {
+        printf("The PDF stream differs from the image.\n");
+        retcode = 2;
+    }
+
+    strcpy(strrchr(jpeg_name, '.'), ".pdf");
+    f = fopen(jpeg_name, "wb");
+    if (!f || fwrite(out, size, 1, f) != 1 || fclose(f)) {
+        perror(jpeg_name);
+        return 3;
+    }
+    printf("%s: %u blocks, %u bytes.\n", jpeg_name, n, size);
+    free(jpeg);
+    free(out);
+    return retcode;
+}
+
+// Write the PNG file for the image, reading it in runs of blocks and then
+// block by block from the end, which has to resume from checkpoints, and
+// compare its size and generation time with the JPEG image's.
+static int write_png(char *name, const struct Layout *layout,
+                     uint8_t *buf, size_t len)
+{
+    // the PNG buffer is taken from the end of the JPEG one, as in main.c
+    uint8_t *end = buf + len - PNG_BUF_SIZE;
+    clock_t t0 = clock();
+    jpeg_set_sequential(true);
+    jpeg_init(buf, end, layout);
+    unsigned jpeg_len = jpeg_size();
+    clock_t t1 = clock();
+    png_init(end, buf + len);
+    unsigned size = png_size();
+    clock_t t2 = clock();
+    unsigned n = (size + 511) / 512, blk, run;
+    uint8_t (*out)[512] = malloc(n * 512);
+    int retcode = 0;
+
+    if (!out) {
+        fputs("Out of memory.\n", stderr);
+        return 1;
+    }
+    for (blk = 0; blk < n; blk += run) {
+        run = n - blk < 128 ? n - blk : 128;
+        uint8_t *bptr = png_get_blocks(blk, &run);
+        memcpy(out[blk], bptr, run * 512);
+    }
+    clock_t t3 = clock();
+    for (blk = n; blk-- > 0; )
+        if (memcmp(png_get_block(blk), out[blk], blk + 1 < n ? 512
+                                                  : size - blk * 512) != 0) {
+            printf("PNG block %u differs from runs.\n", blk);
+            retcode = 2;
+        }
+    clock_t t4 = clock();
+
+    strcpy(strrchr(name, '.'), ".png");
+    FILE *f = fopen(name, "wb");
+    if (!f || fwrite(out, size, 1, f) != 1 || fclose(f)) {
+        perror(name);
+        return 3;
+    }
+    printf("%s: %u bytes in %.1f ms (backwards %.1f ms), "
+            "JPEG %u bytes in %.1f ms.\n", name,
+            size, (t2 - t1) * 1e3 / CLOCKS_PER_SEC,
+            (t4 - t3) * 1e3 / CLOCKS_PER_SEC,
+            jpeg_len, (t1 - t0) * 1e3 / CLOCKS_PER_SEC);
+    free(out);
+    return retcode;
 }
 
 static void usage(void)
@@ -95,6 +242,7 @@ static void usage(void)
     fputs("Usage:  check [options]\n"
           "  -t        testnet\n"
           "  -s        Shamir\n"
+          "  -S M-of-N Shamir with any M of N shares (default 2-of-3)\n"
           "  -u        uncompressed public key\n"
           "  -r NBLK   random access test for the streaming algorithm\n"
           "            with a file size of NBLK 512-byte blocks\n"
@@ -102,6 +250,13 @@ static void usage(void)
           "  -p        Peercoin\n"
           "  -1        use type 1 salt\n"
           "  -d path   HD wallet with xpub at path (-dd for default)\n"
+          "  -R ROWS   restart markers every ROWS macroblock rows\n"
+          "  -a NBLK   read ahead at most NBLK blocks\n"
+          "  -m USEC   simulate USB mass storage reads with USEC microseconds\n"
+          "            of overhead per transfer, per sector and in runs\n"
+          "  -f        also wrap the image in a PDF file, read in runs\n"
+          "  -g        also make a black and white PNG file, and compare its\n"
+          "            size and generation time with the JPEG file's\n"
           "Output is written to sample*.jpg, where * stands for "
           "option-specific suffixes.\n",
           stderr);
@@ -111,12 +266,16 @@ int main(int argc, char *argv[])
 {
     char fname[80];
     uint8_t key[34];
-    uint8_t buf[24576];
+    // as large as the firmware's, from _estack.stream_buf to __ram_end__
+    uint8_t buf[24064];
     uint8_t *bprev, *bptr = 0;
     int blk, xend;
     bool testnet = false, shamir = false;
-    bool litecoin = false, peercoin = false;
+    bool litecoin = false, peercoin = false, pdf = false, png = false;
     int nblk = 0;
+    int restart_rows = 0;
+    double msc_usec = -1;
+    const struct Layout *layout;
     int retcode = 0;
     int i;
 
@@ -137,8 +296,10 @@ int main(int argc, char *argv[])
     }
 
     settings.compressed = true;
+    settings.sss_m = 2;
+    settings.sss_n = 3;
 
-    while ((i = getopt(argc, argv, "tsulp1d:r:h")) != -1)
+    while ((i = getopt(argc, argv, "tsS:ulp1d:r:R:m:a:fgh")) != -1)
         switch (i) {
         case 't':
             testnet = true;
@@ -146,6 +307,20 @@ int main(int argc, char *argv[])
         case 's':
             shamir = true;
             break;
+        case 'S': {
+            unsigned m, n;
+            char end;
+            if (sscanf(optarg, "%u-of-%u%c", &m, &n, &end) != 2
+                    || m < 2 || m > n || n > 15) {
+                fprintf(stderr, "Shares must be M-of-N, "
+                        "with 2 <= M <= N <= 15.\n");
+                return 1;
+            }
+            settings.sss_m = m;
+            settings.sss_n = n;
+            shamir = true;
+            break;
+        }
         case 'u':
             settings.compressed = false;
             break;
@@ -163,6 +338,29 @@ int main(int argc, char *argv[])
             strncpy(settings.hd_path, *optarg == 'd' ? "" : optarg,
                     sizeof settings.hd_path);
             break;
+        case 'R':
+            restart_rows = strtoul(optarg, 0, 0);
+            if (restart_rows < 1 || restart_rows > JHEIGHT) {
+                fprintf(stderr, "ROWS must be between 1 and %d.\n", JHEIGHT);
+                return 1;
+            }
+            break;
+        case 'a':
+            jpeg_set_read_ahead(strtoul(optarg, 0, 0));
+            break;
+        case 'm':
+            msc_usec = strtod(optarg, 0);
+            if (msc_usec < 0) {
+                fprintf(stderr, "USEC must not be negative.\n");
+                return 1;
+            }
+            break;
+        case 'f':
+            pdf = true;
+            break;
+        case 'g':
+            png = true;
+            break;
         case 'r':
             nblk = strtoul(optarg, 0, 0);
             if (nblk > MAX_NBLK) {
@@ -185,6 +383,10 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Testnet is supported for Bitcoin only.\n");
         return 1;
     }
+    if ((pdf || png) && nblk) {
+        fprintf(stderr, "PDF and PNG files need the whole image, not -r.\n");
+        return 1;
+    }
     if (settings.hd && !settings.compressed) {
         fprintf(stderr, "HD wallets work with compressed keys only.\n");
         return 1;
@@ -204,12 +406,14 @@ int main(int argc, char *argv[])
     else
         layout_conditions[COND_COIN] = settings.coin.bip44;
     layout_conditions[COND_SALT] = settings.salt_type;
+    layout_conditions[COND_ANY_TWO] = settings.sss_m == 2;
 
-    snprintf(fname, sizeof fname, "sample%s%s%s%s.jpg",
+    snprintf(fname, sizeof fname, "sample%s%s%s%s%s.jpg",
             settings.hd ? "-hd" : "",
             coin->suffix,
             shamir ? "-sss" : "",
-            settings.salt_type ? "-salt" : "");
+            settings.salt_type ? "-salt" : "",
+            restart_rows ? "-rst" : "");
     FILE *f = fopen(fname, "wb");
     if (!f) {
         perror(fname);
@@ -241,27 +445,78 @@ int main(int argc, char *argv[])
             fprintf(stderr, "Error in HD path.");
             return 1;
         }
-        jpeg_init(buf, buf + sizeof buf, hd_layout);
+        layout = hd_layout;
     } else if (shamir) {
         int len;
-        rs_init(0x11d, 1);  // initialise GF(2^8) for Shamir
         len = keygen(key);  // generate regular key pair
-        sss_encode(2, 3, SSS_BASE58, key, len);
-        jpeg_init(buf, buf + sizeof buf, shamir_layout);
+        sss_encode(settings.sss_m, settings.sss_n, SSS_BASE58, key, len);
+        jpeg_set_pages(settings.sss_n, sss_share);
+        layout = shamir_layout;
     } else {
         keygen(key);        // generate regular key pair
-        jpeg_init(buf, buf + sizeof buf, main_layout);
+        layout = main_layout;
     }
-
-    if (nblk) {
+    jpeg_set_restart_interval(restart_rows);
+    jpeg_init(buf, buf + sizeof buf, layout);
+
+    if (msc_usec >= 0) {
+        // USB mass storage transfers, modelled as full-speed bulk transfers
+        // of 19 64-byte packets per millisecond plus a fixed overhead each
+        enum { BULK_RATE = 19 * 64 * 1000 };
+        unsigned size = jpeg_size(), n = (size + 511) / 512, transfers[2];
+        uint8_t (*out)[512] = malloc(2 * n * 512);
+
+        if (!out) {
+            fputs("Out of memory.\n", stderr);
+            return 1;
+        }
+        for (i = 0; i < 2; i++) {
+            jpeg_init(buf, buf + sizeof buf, layout);
+            memset(&jpeg_stats, 0, sizeof jpeg_stats);
+            transfers[i] = msc_read(out + i * n, n, i);
+            printf("%-10s %5u transfers, %3u stalls, %3u wraps, "
+                    "%6lu bytes generated, %.3f MB/s\n",
+                    i ? "runs:" : "sectors:", transfers[i], jpeg_stats.stalls,
+                    jpeg_stats.wraps, jpeg_stats.bytes,
+                    size / (transfers[i] * msc_usec * 1e-6
+                            + (double) size / BULK_RATE) * 1e-6);
+        }
+        if (memcmp(out, out + n, n * 512) != 0) {
+            printf("Transfers in runs differ from single sectors.\n");
+            retcode = 2;
+        }
+        fwrite(out + n, size, 1, f);
+        printf("%s: written.\n", fname);
+        free(out);
+    } else if (nblk) {
         // random access test of the JPEG streaming algorithm
         bool blkusage[nblk];
         uint8_t out[nblk][512];
+        uint8_t (*ref)[512] = malloc(nblk * 512);
+        int refblk = 0;
+
+        if (!ref) {
+            fputs("Out of memory.\n", stderr);
+            return 1;
+        }
+
+        // sequential reference, with checkpoints reset afterwards
+        do {
+            bprev = bptr;
+            bptr = jpeg_get_block(refblk);
+            memcpy(ref[refblk++], bptr, 512);
+        } while (bprev != bptr && refblk < nblk);
+        jpeg_init(buf, buf + sizeof buf, layout);
+        memset(&jpeg_stats, 0, sizeof jpeg_stats);
 
         memset(blkusage, 0, sizeof blkusage);
         do {
             for (blk = get_random_extent(&xend, nblk); blk != xend; blk++) {
                 bptr = jpeg_get_block(blk);
+                if (blk < refblk && memcmp(bptr, ref[blk], 512) != 0) {
+                    printf("Block %d differs from sequential output.\n", blk);
+                    retcode = 2;
+                }
                 if (blkusage[blk]) {
                     if (memcmp(bptr, out[blk], 512) != 0) {
                         printf("Error at block %d.\n", blk);
@@ -277,21 +532,36 @@ int main(int argc, char *argv[])
             }
         } while (memcmp(blkusage, blkusage + 1, sizeof blkusage - 1) != 0);
         printf("%s: written.\n", fname);
+        printf("%u restarts, %u resumes from checkpoints, %u stalls, %u wraps, "
+                "%lu bytes generated (%.1f times the image).\n",
+                jpeg_stats.restarts, jpeg_stats.resumes, jpeg_stats.stalls,
+                jpeg_stats.wraps, jpeg_stats.bytes,
+                (double) jpeg_stats.bytes / (refblk * 512));
+        free(ref);
     } else {
-        // generate JPEG sequentially until EOF
-        blk = 0;
-        do {
-            bprev = bptr;
-            bptr = jpeg_get_block(blk++);
-            fwrite(bptr, 512, 1, f);
-        } while (bprev != bptr);
-        printf("%s: %d blocks.\n", fname, blk);
+        // generate JPEG sequentially up to its exact size
+        unsigned size = jpeg_size(), len = 512;
+        for (blk = 0; blk * 512 < size; blk++) {
+            bptr = jpeg_get_block(blk);
+            if (size - blk * 512 < len)
+                len = size - blk * 512;
+            fwrite(bptr, len, 1, f);
+        }
+        if (bptr[len - 2] != 0xFF || bptr[len - 1] != 0xD9) {
+            printf("%s: no EOI marker at the end.\n", fname);
+            retcode = 2;
+        }
+        printf("%s: %d blocks, %u bytes.\n", fname, blk, size);
     }
 
     if (fclose(f)) {
         perror(fname);
         retcode = 3;
     }
+    if (pdf && !retcode)
+        retcode = write_pdf(fname);
+    if (png && !retcode)
+        retcode = write_png(fname, layout, buf, sizeof buf);
     fclose(xflash_file);
 
     return retcode;
@@ -0,0 +1,164 @@
+/*
+ * Recombine Shamir shares printed by Mycelium Entropy and check them
+ * against their addresses.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Usage: combine [-j threads] file
+//
+// Each non-empty line holds one share set: its "SSS-" shares and,
+// optionally, the address of the private key, separated by whitespace.
+// The secret is recovered from each run of threshold consecutive shares
+// (wrapping around), so that every share is checked when there are more than
+// the threshold.  The secret must be a private key in SIPA format, and give
+// the address if there is one.  Failed sets are listed in order, followed by
+// the counts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lib/base58.h"
+#include "lib/bignum.h"
+#include "lib/ecdsa.h"
+#include "rng.h"
+#include "settings.h"
+#include "sss.h"
+#include "lines.h"
+
+// Global variables expected by the embedded software.
+struct Settings settings;
+
+// ecdsa.c needs random numbers for signing, which is not done here.
+void rng_next(uint32_t random_number[8])
+{
+    (void) random_number;
+    abort();
+}
+
+enum {
+    // maximum number of shares in a set
+    MAX_SHARES  = 16,
+};
+
+// Check the share set on one line, from p to end.
+// Return 0 if it is good, or the reason why not.
+static const char *check_set(const char *p, const char *end)
+{
+    uint8_t share[MAX_SHARES][4 + SSS_MAX_SECRET_SIZE];
+    const uint8_t *set[MAX_SHARES];
+    uint8_t secret[SSS_MAX_SECRET_SIZE], first[SSS_MAX_SECRET_SIZE];
+    const char *address = 0;
+    int address_len = 0;
+    int count = 0, len = 0, m, i, j, n;
+
+    while (p < end) {
+        const char *w = p;
+        while (w < end && is_space(*w))
+            w++;
+        p = w;
+        while (p < end && !is_space(*p))
+            p++;
+        if (w == p)
+            break;
+
+        if (p - w > 4 && memcmp(w, "SSS-", 4) == 0) {
+            if (count == MAX_SHARES)
+                return "too many shares";
+            n = base58check_decode_len(w + 4, p - w - 4, share[count],
+                                       sizeof share[count]);
+            if (n < 0)
+                return "bad Base58Check";
+            if (n < 5 || (count && n != len))
+                return "bad share length";
+            if (share[count][0] != SSS_BASE58)
+                return "unknown share content type";
+            len = n;
+            count++;
+        } else if (address) {
+            return "more than one address";
+        } else {
+            address = w;
+            address_len = p - w;
+        }
+    }
+
+    if (!count)
+        return "no shares";
+
+    m = (share[0][3] >> 4) + 1;
+    if (count < m)
+        return "not enough shares";
+
+    // recover the secret from each run of m shares
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < m; j++)
+            set[j] = share[(i + j) % count];
+        if (sss_decode(set, m, len, secret) < 0)
+            return "mixed share sets or repeated share";
+        if (i == 0)
+            memcpy(first, secret, len - 4);
+        else if (memcmp(first, secret, len - 4) != 0)
+            return "inconsistent shares";
+        if (count == m)
+            break;
+    }
+
+    // private key in SIPA format: version, key, optional compression flag
+    len -= 4;
+    bignum256 key;
+    if (!(secret[0] & 0x80) || len < 33 || len > 34
+            || (len == 34 && secret[33] != 1))
+        return "secret is not a private key";
+    bn_read_be(secret + 1, &key);
+    if (bn_is_zero(&key) || !bn_is_less(&key, &order256k1))
+        return "private key out of range";
+
+    if (address) {
+        curve_point pub;
+        char computed[36];
+        scalar_multiply(&key, &pub);
+        base58_encode_address(&pub, secret[0] & 0x7f, len == 34, computed);
+        if ((int)strlen(computed) != address_len
+                || memcmp(computed, address, address_len) != 0)
+            return "address does not match";
+    }
+
+    return 0;
+}
+
+static const char *check_line(const char **text, int *len,
+                              unsigned long count[])
+{
+    count[0]++;
+    return check_set(*text, *text + *len);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long sets;
+
+    unsigned long failed = check_lines(argc, argv,
+            "Usage: combine [-j threads] file", check_line, &sets, 1);
+
+    printf("%10lu share sets\n", sets);
+    if (failed)
+        printf("%10lu failed\n", failed);
+
+    return failed != 0;
+}
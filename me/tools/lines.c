@@ -0,0 +1,175 @@
+/*
+ * Check the lines of a text file on several threads.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lines.h"
+
+struct Error {
+    unsigned long line;         // within the chunk, from 0
+    const char *reason;
+    const char *text;
+    int len;
+};
+
+struct Job {
+    pthread_t thread;
+    check_line_fn *check;
+    const char *start, *end;
+    unsigned long lines;
+    unsigned long count[LINES_MAX_COUNTS];
+    struct Error *errors;
+    size_t num_errors, max_errors;
+};
+
+bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void *worker(void *arg)
+{
+    struct Job *job = arg;
+    const char *p = job->start;
+
+    while (p < job->end) {
+        const char *eol = memchr(p, '\n', job->end - p);
+        if (!eol)
+            eol = job->end;
+
+        // skip empty lines
+        const char *s = p;
+        while (s < eol && is_space(*s))
+            s++;
+        const char *e = eol;
+        while (e > s && is_space(e[-1]))
+            e--;
+
+        if (s != e) {
+            int len = e - s;
+            const char *reason = job->check(&s, &len, job->count);
+            if (reason) {
+                if (job->num_errors == job->max_errors) {
+                    job->max_errors = job->max_errors * 2 + 16;
+                    job->errors = realloc(job->errors,
+                            job->max_errors * sizeof *job->errors);
+                    if (!job->errors) {
+                        fputs("Out of memory.\n", stderr);
+                        exit(2);
+                    }
+                }
+                job->errors[job->num_errors++] = (struct Error) {
+                    job->lines, reason, s, len
+                };
+            }
+        }
+
+        job->lines++;
+        p = eol + 1;
+    }
+    return 0;
+}
+
+static void print_usage(const char *usage)
+{
+    puts(usage);
+    exit(2);
+}
+
+unsigned long check_lines(int argc, char *argv[], const char *usage,
+                          check_line_fn *check, unsigned long count[],
+                          int num_counts)
+{
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    assert(num_counts <= LINES_MAX_COUNTS);
+
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt != 'j')
+            print_usage(usage);
+        nthreads = atoi(optarg);
+    }
+    if (optind != argc - 1 || nthreads < 1)
+        print_usage(usage);
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        perror(argv[optind]);
+        exit(2);
+    }
+    size_t len = st.st_size;
+    const char *text = "";
+    if (len) {
+        text = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (text == MAP_FAILED) {
+            perror("mmap");
+            exit(2);
+        }
+    }
+
+    // Split the file into chunks at line boundaries.
+    struct Job *jobs = calloc(nthreads, sizeof *jobs);
+    if (!jobs) {
+        fputs("Out of memory.\n", stderr);
+        exit(2);
+    }
+    const char *p = text, *end = text + len;
+    for (long i = 0; i < nthreads; i++) {
+        const char *e = text + len * (i + 1) / nthreads;
+        if (e < p)
+            e = p;
+        const char *eol = memchr(e, '\n', end - e);
+        jobs[i].check = check;
+        jobs[i].start = p;
+        jobs[i].end = p = eol && i + 1 < nthreads ? eol + 1 : end;
+        if (pthread_create(&jobs[i].thread, 0, worker, &jobs[i])) {
+            perror("pthread_create");
+            exit(2);
+        }
+    }
+
+    unsigned long failed = 0, line = 1;
+    memset(count, 0, num_counts * sizeof *count);
+    for (long i = 0; i < nthreads; i++) {
+        struct Job *job = &jobs[i];
+        pthread_join(job->thread, 0);
+        for (size_t e = 0; e < job->num_errors; e++)
+            printf("line %lu: %s: %.*s\n", line + job->errors[e].line,
+                    job->errors[e].reason, job->errors[e].len,
+                    job->errors[e].text);
+        for (int k = 0; k < num_counts; k++)
+            count[k] += job->count[k];
+        failed += job->num_errors;
+        line += job->lines;
+        free(job->errors);
+    }
+    free(jobs);
+
+    return failed;
+}
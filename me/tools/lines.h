@@ -0,0 +1,47 @@
+/*
+ * Check the lines of a text file on several threads.
+ *
+ * Copyright 2015 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdbool.h>
+
+enum {
+    // maximum number of counters kept for each thread
+    LINES_MAX_COUNTS = 8,
+};
+
+// Check one non-empty line, without its leading and trailing whitespace,
+// and add to the counters in count[].  Return 0 if it is good, or the reason
+// why not; *text and *len may be narrowed to the part to show with it.
+// This is called on several threads at once.
+typedef const char *check_line_fn(const char **text, int *len,
+                                  unsigned long count[]);
+
+bool is_space(char c);
+
+// Parse "[-j threads] file" from the command line, then map the file and
+// check its lines in as many chunks, split at line boundaries.  Failed lines
+// are printed in order, and count[0..num_counts) gets the totals.
+// Return the number of failed lines; usage and I/O errors exit with status 2.
+unsigned long check_lines(int argc, char *argv[], const char *usage,
+                          check_line_fn *check, unsigned long count[],
+                          int num_counts);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Replay raw entropy samples through the continuous health tests.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Input files are either SD card images written by the collect/ firmware
+// (a header block followed by PORTION bytes of SRAM, repeated), or plain
+// binary dumps.  Samples are fed as bytes with the ADC cutoffs (default),
+// or as 32-bit words with the TRNG cutoffs (-t).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "health.h"
+#include "collect/collect.h"
+
+
+static bool words;
+static unsigned rct_cutoff = ADC_RCT_CUTOFF;
+static unsigned apt_cutoff = ADC_APT_CUTOFF;
+
+struct Totals {
+    unsigned long long samples;
+    unsigned long long rct_failures;
+    unsigned long long apt_failures;
+    double seconds;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void replay(struct Health_test *t, const uint8_t *data, size_t len,
+        struct Totals *tot)
+{
+    double start = now();
+
+    if (words) {
+        len /= 4;
+        health_words(t, (const uint32_t *)data, len);
+    } else
+        health_bytes(t, data, len);
+
+    tot->seconds += now() - start;
+    tot->samples += len;
+}
+
+// Check whether the buffer looks like an SD card image from collect/.
+static bool is_record_image(const uint8_t *data, size_t len)
+{
+    const struct Record_header *hdr = (const void *)data;
+    return len >= RECORD_BLOCKS * RECORD_BLOCK
+        && len % (RECORD_BLOCKS * RECORD_BLOCK) == 0
+        && hdr->size == PORTION;
+}
+
+static bool replay_file(const char *name, struct Totals *tot)
+{
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        perror(name);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t len = ftell(f);
+    rewind(f);
+
+    uint8_t *data = malloc(len + 4);
+    if (!data || fread(data, 1, len, f) != len) {
+        fprintf(stderr, "%s: read error\n", name);
+        fclose(f);
+        free(data);
+        return false;
+    }
+    fclose(f);
+
+    struct Totals file = { 0 };
+    unsigned nrec = 0;
+
+    if (is_record_image(data, len)) {
+        // Each power-up sample is an independent sequence,
+        // so the tests are restarted for every record.
+        for (size_t off = 0; off < len; off += RECORD_BLOCKS * RECORD_BLOCK) {
+            const struct Record_header *hdr = (const void *)(data + off);
+            if (hdr->size != PORTION || hdr->cycle != nrec) {
+                fprintf(stderr, "%s: bad record header at block %zu\n",
+                        name, off / RECORD_BLOCK);
+                break;
+            }
+            struct Health_test t = HEALTH_TEST(rct_cutoff, apt_cutoff);
+            replay(&t, data + off + RECORD_BLOCK, PORTION, &file);
+            file.rct_failures += t.rct_failures;
+            file.apt_failures += t.apt_failures;
+            nrec++;
+        }
+    } else {
+        struct Health_test t = HEALTH_TEST(rct_cutoff, apt_cutoff);
+        replay(&t, data, len, &file);
+        file.rct_failures = t.rct_failures;
+        file.apt_failures = t.apt_failures;
+    }
+    free(data);
+
+    printf("%s: ", name);
+    if (nrec)
+        printf("%u records, ", nrec);
+    printf("%llu samples, RCT failures %llu, APT failures %llu, "
+            "%.2f ns/sample\n", file.samples, file.rct_failures,
+            file.apt_failures, file.samples ? file.seconds * 1e9 / file.samples : 0);
+
+    tot->samples += file.samples;
+    tot->rct_failures += file.rct_failures;
+    tot->apt_failures += file.apt_failures;
+    tot->seconds += file.seconds;
+    return true;
+}
+
+static void usage(void)
+{
+    puts("Usage: replay [-t] [-c RCT,APT] file...\n"
+        "Options:\n"
+        "  -t          samples are 32-bit TRNG words (default: ADC bytes)\n"
+        "  -c RCT,APT  override the test cutoffs");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    bool cutoffs = false;
+
+    while ((opt = getopt(argc, argv, "tc:")) != -1) {
+        switch (opt) {
+        case 't':
+            words = true;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%u,%u", &rct_cutoff, &apt_cutoff) != 2)
+                usage();
+            cutoffs = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind == argc)
+        usage();
+
+    if (words && !cutoffs) {
+        rct_cutoff = TRNG_RCT_CUTOFF;
+        apt_cutoff = TRNG_APT_CUTOFF;
+    }
+    printf("%s samples, RCT cutoff %u, APT cutoff %u, window %u.\n",
+            words ? "32-bit" : "8-bit", rct_cutoff, apt_cutoff, HEALTH_WINDOW);
+
+    struct Totals tot = { 0 };
+    bool ok = true;
+    for (; optind < argc; optind++)
+        ok &= replay_file(argv[optind], &tot);
+
+    if (tot.samples)
+        printf("Total: %llu samples, %.3g failures per million samples, "
+                "%.2f ns/sample\n", tot.samples,
+                (tot.rct_failures + tot.apt_failures) * 1e6 / tot.samples,
+                tot.seconds * 1e9 / tot.samples);
+
+    return !ok;
+}
@@ -27,6 +27,7 @@
 #include "lib/rs.h"
 #include "lib/sha256.h"
 #include "lib/ripemd.h"
+#include "lib/hash160.h"
 #include "lib/sha512.h"
 #include "lib/pbkdf2.h"
 #include "lib/base58.h"
@@ -37,6 +38,7 @@
 #include "keygen.h"
 #include "sss.h"
 #include "hd.h"
+#include "words.h"
 
 extern uint32_t _estack[1024 * 15 / 4];
 extern uint32_t __ram_end__;
@@ -84,8 +86,6 @@ int main(int argc, char *argv[])
 {
     int i, x;
 
-    rs_init(0x11d, 1);
-
     for (i = 0; i < sizeof _estack / sizeof _estack[0]; i++)
         _estack[i] = random();
 
@@ -101,8 +101,10 @@ int main(int argc, char *argv[])
 
         sss_encode(test_net, compressed, i, 5);
 
-        for (x = 1; x <= 5; x++)
-            printf("Share: %d %s\n", x, texts[IDX_SSS_PART(x)]);
+        for (x = 1; x <= 5; x++) {
+            sss_share(x);
+            printf("Share: %d %s\n", x, texts[IDX_SSS_SHARE]);
+        }
         putchar('\n');
     }
 
@@ -369,6 +371,313 @@ static void test_base58(void)
     puts("Base58 test PASSED.\n");
 }
 
+// Byte-at-a-time Base58Check encoder, as it was before the limb-based one.
+static void base58check_encode_ref(const uint8_t *data, int len, char *b58_buf)
+{
+    uint8_t num[len + 4];
+    uint32_t hash[SHA256_SIZE / 4];
+    unsigned num_is_non_zero;
+    int i, j;
+
+    sha256_twice(hash, data, len);
+    memcpy(num, data, len);
+    memcpy(num + len, hash, 4);
+
+    i = 0;
+    do {
+        unsigned rem = 0, tmp;
+        num_is_non_zero = 0;
+
+        for (j = 0; j < len + 4; j++) {
+            tmp = rem * 24 + num[j];
+            num_is_non_zero |= num[j] = rem * 4 + tmp / 58;
+            rem = tmp % 58;
+        }
+        b58_buf[i++] = base58_map[rem];
+    } while (num_is_non_zero);
+
+    for (j = 0; j < len && !data[j]; j++)
+        b58_buf[i++] = '1';
+    b58_buf[i--] = 0;
+
+    for (j = i >> 1; j >= 0; --j) {
+        uint8_t tmp = b58_buf[j];
+        b58_buf[j] = b58_buf[i - j];
+        b58_buf[i - j] = tmp;
+    }
+}
+
+static void test_base58_random(void)
+{
+    unsigned i;
+
+    for (i = 0; i < 10000; i++) {
+        uint8_t data[100];
+        char str[150], ref[150];
+        int len = 1 + random() % sizeof data;
+        int zeros = random() % 4 ? 0 : random() % (len + 1);
+        int j;
+
+        for (j = 0; j < len; j++)
+            data[j] = j < zeros ? 0 : random();
+
+        base58check_encode(data, len, str);
+        base58check_encode_ref(data, len, ref);
+        if (strcmp(str, ref) != 0) {
+            printf("Base58 random test %u FAILED: output '%s',\n"
+                   "  expected '%s'.\n", i, str, ref);
+            abort();
+        }
+
+        uint8_t back[sizeof data];
+        if (base58check_decode(str, back, len) != len
+                || memcmp(back, data, len) != 0
+                || base58check_decode(str, back, len - 1) != -1) {
+            printf("Base58 random test %u FAILED: cannot decode '%s'.\n",
+                    i, str);
+            abort();
+        }
+
+        // replace one character with another valid one
+        j = random() % strlen(str);
+        char *c = strchr(base58_map, str[j]);
+        str[j] = base58_map[(c - base58_map + 1 + random() % 57) % 58];
+        if (base58check_decode(str, back, sizeof back) != -1) {
+            printf("Base58 random test %u FAILED: accepted bad checksum "
+                    "in '%s'.\n", i, str);
+            abort();
+        }
+    }
+
+    puts("Base58 random test PASSED.\n");
+}
+
+static void test_rs(void)
+{
+    // version 1-M QR code for "HELLO WORLD"
+    static const uint8_t msg[16] = {
+        32, 91, 11, 120, 209, 114, 220, 77, 67, 64, 236, 17, 236, 17, 236, 17
+    }, ecc[10] = {
+        196, 35, 39, 119, 235, 215, 231, 226, 93, 23
+    };
+    struct RS_encoder rs;
+    uint8_t buf[64 + RS_MAX_DEGREE], out[RS_MAX_DEGREE];
+    unsigned i, j, b, n;
+
+    // check the constant GF(2^8) tables
+    for (i = 0, b = 1; i < 255; i++) {
+        if (gf_exp[i] != b || gf_log[b] != i) {
+            printf("RS test FAILED: GF tables differ at %u.\n", i);
+            abort();
+        }
+        b <<= 1;
+        if (b & 0x100)
+            b ^= 0x11d;
+    }
+
+    rs_init(&rs, 10);
+    rs_encode(&rs, msg, sizeof msg, out);
+    if (memcmp(out, ecc, sizeof ecc) != 0) {
+        printf("RS test FAILED: bad ECC for the QR code example.\n");
+        abort();
+    }
+
+    // compare with polynomial long division by the generator,
+    // whose roots are 2**0 to 2**(n-1)
+    for (n = 1; n <= RS_MAX_DEGREE; n++) {
+        uint8_t gen[RS_MAX_DEGREE + 1] = { 1 };
+        unsigned len = 1 + random() % 64;
+
+        for (i = 0; i < n; i++) {
+            // multiply gen by (x ^ 2**i)
+            for (j = i + 1; j > 0; j--)
+                gen[j] = gen[j - 1] ^ (gen[j] ? gf_exp[(gf_log[gen[j]] + i)
+                                                       % 255] : 0);
+            gen[0] = gen[0] ? gf_exp[(gf_log[gen[0]] + i) % 255] : 0;
+        }
+
+        for (i = 0; i < len; i++)
+            buf[i] = random();
+        memset(buf + len, 0, n);
+        rs_init(&rs, n);
+        rs_encode(&rs, buf, len, out);
+
+        for (i = 0; i < len; i++) {
+            unsigned c = buf[i];
+            if (c)
+                for (j = 1; j <= n; j++)
+                    buf[i + j] ^= gen[n - j] ? gf_exp[(gf_log[gen[n - j]]
+                                                + gf_log[c]) % 255] : 0;
+        }
+        if (memcmp(out, buf + len, n) != 0) {
+            printf("RS test FAILED: degree %u.\n", n);
+            abort();
+        }
+    }
+
+    puts("RS test PASSED.\n");
+}
+
+static void test_sss(void)
+{
+    unsigned i;
+
+    for (i = 0; i < 1000; i++) {
+        uint8_t key[SSS_MAX_SECRET_SIZE], back[SSS_MAX_SECRET_SIZE];
+        uint8_t share[3][4 + SSS_MAX_SECRET_SIZE];
+        const uint8_t *set[3];
+        int len = 1 + random() % SSS_MAX_SECRET_SIZE;
+        int m = 1 + random() % 3;
+        int x, n;
+
+        for (x = 0; x < len; x++)
+            key[x] = random();
+        sss_encode(m, 3, SSS_BASE58, key, len);
+        for (x = 0; x < 3; x++) {
+            sss_share(x + 1);
+            n = base58check_decode(texts[IDX_SSS_SHARE] + 4, share[x],
+                                   sizeof share[x]);
+            assert(n == 4 + len);
+        }
+
+        // every choice of m shares, in either order
+        for (x = 0; x < 3; x++) {
+            set[0] = share[x];
+            set[1] = share[(x + 1 + i % 2) % 3];
+            set[2] = share[(x + 2 - i % 2) % 3];
+            if (sss_decode(set, m, 4 + len, back) != len
+                    || memcmp(back, key, len) != 0) {
+                printf("SSS test %u FAILED: %d of 3 from share %d.\n",
+                       i, m, x + 1);
+                abort();
+            }
+        }
+
+        // too few shares, or the same share twice
+        set[1] = set[0];
+        if (sss_decode(set, m - 1, 4 + len, back) != -1
+                || (m > 1 && sss_decode(set, m, 4 + len, back) != -1)) {
+            printf("SSS test %u FAILED: accepted a bad share set.\n", i);
+            abort();
+        }
+    }
+
+    // m of up to 15 shares, each made again after the others
+    for (i = 0; i < 200; i++) {
+        uint8_t key[SSS_MAX_SECRET_SIZE], back[SSS_MAX_SECRET_SIZE];
+        uint8_t share[15][4 + SSS_MAX_SECRET_SIZE];
+        char first[SSS_STRING_SIZE];
+        const uint8_t *set[15];
+        int len = 1 + random() % SSS_MAX_SECRET_SIZE;
+        int n = 2 + random() % 14;
+        int m = 2 + random() % (n - 1);
+        int x, k;
+
+        for (x = 0; x < len; x++)
+            key[x] = random();
+        sss_encode(m, n, SSS_BASE58, key, len);
+        sss_share(1);
+        strcpy(first, texts[IDX_SSS_SHARE]);
+        for (x = n - 1; x >= 0; x--) {
+            sss_share(x + 1);
+            k = base58check_decode(texts[IDX_SSS_SHARE] + 4, share[x],
+                                   sizeof share[x]);
+            assert(k == 4 + len);
+        }
+        if (strcmp(first, texts[IDX_SSS_SHARE]) != 0) {
+            printf("SSS test %u FAILED: share 1 of %d changed.\n", i, n);
+            abort();
+        }
+
+        // m distinct shares in random order
+        for (x = 0; x < n; x++)
+            set[x] = share[x];
+        for (x = 0; x < m; x++) {
+            const uint8_t *t = set[x];
+            k = x + random() % (n - x);
+            set[x] = set[k];
+            set[k] = t;
+        }
+        if (sss_decode(set, m, 4 + len, back) != len
+                || memcmp(back, key, len) != 0) {
+            printf("SSS test %u FAILED: %d of %d.\n", i, m, n);
+            abort();
+        }
+    }
+
+    puts("SSS test PASSED.\n");
+}
+
+// check_word() of tools/validate on every share of m-of-n sets
+static void test_words(void)
+{
+    uint8_t key[SSS_MAX_SECRET_SIZE];
+    int m, n, x, len;
+
+    for (x = 0; x < SSS_MAX_SECRET_SIZE; x++)
+        key[x] = random();
+
+    for (n = 1; n <= 15; n++) {
+        for (m = 1; m <= n; m++) {
+            sss_encode(m, n, SSS_BASE58, key,
+                       1 + random() % SSS_MAX_SECRET_SIZE);
+            for (x = 1; x <= n; x++) {
+                char *share = texts[IDX_SSS_SHARE];
+                enum Kind kind;
+                const char *reason;
+
+                sss_share(x);
+                len = strlen(share);
+                reason = check_word(share, len, &kind);
+                // the firmware never makes shares with a threshold of 1
+                if (m == 1 ? kind != INVALID : reason || kind != SSS_SHARE) {
+                    printf("Words test FAILED: share %d of %d-of-%d: %s\n",
+                           x, m, n, reason ? reason : "accepted");
+                    abort();
+                }
+
+                // a changed character fails the checksum
+                share[len / 2] = share[len / 2] == '2' ? '3' : '2';
+                if (!check_word(share, len, &kind) || kind != INVALID) {
+                    printf("Words test FAILED: changed share %d of %d-of-%d "
+                           "accepted.\n", x, m, n);
+                    abort();
+                }
+            }
+        }
+    }
+
+    puts("Words test PASSED.\n");
+}
+
+static void test_hash160(void)
+{
+    unsigned i, len;
+
+    for (i = 0; i < 1000; i++) {
+        uint8_t pub[65];
+        uint32_t hash[5], ref[5], tmp[SHA256_SIZE / 4];
+
+        for (len = 0; len < sizeof pub; len++)
+            pub[len] = random();
+
+        len = i & 1 ? 65 : 33;
+        sha256_hash(tmp, pub, len);
+        ripemd160_hash(ref, (uint8_t *) tmp, sizeof tmp);
+        if (len == 33)
+            hash160_33(hash, pub);
+        else
+            hash160_65(hash, pub);
+
+        if (memcmp(hash, ref, sizeof hash) != 0) {
+            printf("HASH160 test %u FAILED.\n", i);
+            abort();
+        }
+    }
+
+    puts("HASH160 test PASSED.\n");
+}
+
 static void test_parser(void)
 {
     static const struct {
@@ -382,6 +691,8 @@ static void test_parser(void)
         char *hd_path;
         const char (*keys)[2][65];
         int nkeys;
+        uint8_t sss_m, sss_n;
+        uint8_t image;
     } tests[] = {
         {
             "  # comment\r\n coin bitcoin  # test\ncompressed\r\n# another comment\n"
@@ -389,7 +700,8 @@ static void test_parser(void)
             "sign 2665 9c1cf7321c178c07437150639ff0c5b7679c7ea195253ed9abda2e\r\n"
             "081a37 00000000 \n"
             " 00000000000000000000000000000000000000000000000000000000",
-            BITCOIN, true, 1, 4, { 0xde, 0xad, 0xbe, 0xef }, false, "", &public_keys[0], 1
+            BITCOIN, true, 1, 4, { 0xde, 0xad, 0xbe, 0xef }, false, "", &public_keys[0], 1,
+            2, 3
         },
         {
             "coin   ltC \r\nsign\n   \n"
@@ -400,6 +712,7 @@ static void test_parser(void)
             "salt1 01234567 89abcdef aabbccdd 11223344 5432fecb 24681357 a1b2c3d4"
             " ff99ee88#max salt\n"
             "hd  m/11/22'/33\n"
+            "shamir 3-of-5\n"
             " uncompressed # really?\n"
             "sign 96e8f2093f018aff6c2e2da5201ee528e2c8accbf9cac51563d33a7bb74a0160\n"
             "54201c025e2a5d96b1629b95194e806c63eb96facaedc733b1a4b70ab3b33e3a\n",
@@ -408,23 +721,34 @@ static void test_parser(void)
                 0xaa, 0xbb, 0xcc, 0xdd,  0x11, 0x22, 0x33, 0x44,
                 0x54, 0x32, 0xfe, 0xcb,  0x24, 0x68, 0x13, 0x57,
                 0xa1, 0xb2, 0xc3, 0xd4,  0xff, 0x99, 0xee, 0x88,
-            }, true, "m/11/22'/33", &public_keys[3], 2
+            }, true, "m/11/22'/33", &public_keys[3], 2, 3, 5
         },
-        {   "illegal command",      0, true, 0, 0, {}, false, "", 0, -2  },
-        {   "coin unknown",         0, true, 0, 0, {}, false, "", 0, -2  },
-        {   "coin\nuncompressed\n", 0, true, 0, 0, {}, false, "", 0, -2  },
-        {   "coin btc coin ltc\n",  0, true, 0, 0, {}, false, "", 0, -2  },
+        {   "illegal command",      0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "coin unknown",         0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "coin\nuncompressed\n", 0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "coin btc coin ltc\n",  0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
         {   "coin 96e8f2093f018aff6c2e2da5201ee528e2c8accbf9cac51563d33a7bb74a0160",
-                                    0, true, 0, 0, {}, false, "", 0, -2  },
-        {   "sign hmm",             0, true, 0, 0, {}, false, "", 0, -2  },
-        {   "sign 01",              0, true, 0, 0, {}, false, "", 0, -2  },
-        {   "salt1 abc",            0, true, 1, 1, {}, false, "", 0, -2  },
-        {   "hd",                   0, true, 0, 0, {}, true,  "", 0,  0  },
-        {   "hd xyz abc",           0, true, 0, 0, {}, true,  "xyz", 0, -2 },
+                                    0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "sign hmm",             0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "sign 01",              0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "salt1 abc",            0, true, 1, 1, {}, false, "", 0, -2, 2, 3 },
+        {   "hd",                   0, true, 0, 0, {}, true,  "", 0,  0, 2, 3 },
+        {   "hd xyz abc",           0, true, 0, 0, {}, true,  "xyz", 0, -2, 2, 3 },
         {   "hd abcdefghijklmnopqrstuvwxyz12345", 0, true, 0, 0, {}, true,
-               "abcdefghijklmnopqrstuvwxyz12345", 0, 0 },
+               "abcdefghijklmnopqrstuvwxyz12345", 0, 0, 2, 3 },
         {   "hd abcdefghijklmnopqrstuvwxyz123456", 0, true, 0, 0, {}, true,
-               "", 0, -2 },
+               "", 0, -2, 2, 3 },
+        {   "shamir 15-of-15",      0, true, 0, 0, {}, false, "", 0,  0, 15, 15 },
+        {   "shamir 3 of 5",        0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "shamir\ncompressed",   0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "shamir 4-of-3",        0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "shamir 1-of-3",        0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "shamir 2-of-16",       0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "image PNG\nimage jpg\nimage png", 0, true, 0, 0, {}, false, "",
+                                       0,  0, 2, 3, IMAGE_PNG },
+        {   "image JPEG",           0, true, 0, 0, {}, false, "", 0,  0, 2, 3 },
+        {   "image gif",            0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
+        {   "image",                0, true, 0, 0, {}, false, "", 0, -2, 2, 3 },
     };
 
     unsigned i;
@@ -460,6 +784,19 @@ static void test_parser(void)
                 abort();
             }
 
+            if (settings.sss_m != tests[i].sss_m
+             || settings.sss_n != tests[i].sss_n) {
+                printf("Parser test %u FAILED: shares %d-of-%d.\n", i,
+                        settings.sss_m, settings.sss_n);
+                abort();
+            }
+
+            if (settings.image != tests[i].image) {
+                printf("Parser test %u FAILED: image format %d.\n", i,
+                        settings.image);
+                abort();
+            }
+
             if (nkeys > j)
                 nkeys = j;
             int k;
@@ -796,6 +1133,11 @@ int main()
 {
     test_xxtea();
     test_base58();
+    test_base58_random();
+    test_rs();
+    test_sss();
+    test_words();
+    test_hash160();
     test_parser();
     gen_hash(160);
     gen_hash(256);
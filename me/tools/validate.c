@@ -0,0 +1,66 @@
+/*
+ * Validate Base58Check strings printed by Mycelium Entropy.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Usage: validate [-j threads] file
+//
+// The last whitespace-separated word on each line is checked, so that both
+// bare lists and "Label: value" logs can be fed in.  Empty lines are skipped.
+// Invalid lines are listed in order, followed by counts for each kind.
+
+#include <stdio.h>
+
+#include "lines.h"
+#include "words.h"
+
+
+static const char *const kind_names[NUM_KINDS] = {
+    "addresses", "private keys (WIF, uncompressed)",
+    "private keys (WIF, compressed)", "extended public keys",
+    "SSS shares", "invalid",
+};
+
+// Check the last word on a line.
+static const char *check_line(const char **text, int *len,
+                              unsigned long count[])
+{
+    const char *we = *text + *len, *ws = we;
+    while (ws > *text && !is_space(ws[-1]))
+        ws--;
+
+    enum Kind kind;
+    const char *reason = check_word(ws, we - ws, &kind);
+    count[kind]++;
+    *text = ws;
+    *len = we - ws;
+    return reason;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long count[NUM_KINDS];
+
+    check_lines(argc, argv, "Usage: validate [-j threads] file",
+                check_line, count, NUM_KINDS);
+
+    for (int k = 0; k < NUM_KINDS; k++)
+        if (count[k])
+            printf("%10lu %s\n", count[k], kind_names[k]);
+
+    return count[INVALID] != 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Classify the Base58Check strings printed by Mycelium Entropy.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "lib/base58.h"
+#include "sss.h"
+#include "words.h"
+
+const char *check_word(const char *w, int len, enum Kind *kind)
+{
+    static const uint8_t xpub_version[][4] = {
+        { 0x04, 0x88, 0xB2, 0x1E }, // mainnet
+        { 0x04, 0x35, 0x87, 0xCF }, // testnet
+        { 0x01, 0x9d, 0xa4, 0x62 }, // Litecoin
+    };
+    uint8_t buf[100];
+    int n;
+
+    *kind = INVALID;
+
+    if (len > 4 && memcmp(w, "SSS-", 4) == 0) {
+        n = base58check_decode_len(w + 4, len - 4, buf, sizeof buf);
+        if (n < 0)
+            return "bad Base58Check";
+        if (n < 5 || n > 4 + SSS_MAX_SECRET_SIZE)
+            return "bad share length";
+        if (buf[0] != SSS_BASE58)
+            return "unknown share content type";
+        // threshold - 1 and x - 1: every x is valid, but m is at least 2
+        if ((buf[3] >> 4) == 0)
+            return "bad share threshold";
+        *kind = SSS_SHARE;
+        return 0;
+    }
+
+    n = base58check_decode_len(w, len, buf, sizeof buf);
+    switch (n) {
+    case -1:
+        return "bad Base58Check";
+    case 21:
+        *kind = ADDRESS;
+        return 0;
+    case 33:
+        if (!(buf[0] & 0x80))
+            return "bad WIF version";
+        *kind = WIF;
+        return 0;
+    case 34:
+        if (!(buf[0] & 0x80) || buf[33] != 1)
+            return "bad compressed WIF";
+        *kind = WIF_COMPRESSED;
+        return 0;
+    case 78:
+        for (n = 0; n < (int)(sizeof xpub_version / sizeof xpub_version[0]); n++) {
+            if (memcmp(buf, xpub_version[n], 4) == 0) {
+                if (buf[45] != 2 && buf[45] != 3)
+                    return "bad public key in xpub";
+                *kind = XPUB;
+                return 0;
+            }
+        }
+        return "unknown extended key version";
+    default:
+        return "unexpected length";
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Classify the Base58Check strings printed by Mycelium Entropy.
+ *
+ * Copyright 2014 Mycelium SA, Luxembourg.
+ *
+ * This file is part of Mycelium Entropy.
+ *
+ * Mycelium Entropy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.  See file GPL in the source code
+ * distribution or <http://www.gnu.org/licenses/>.
+ *
+ * Mycelium Entropy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef WORDS_H
+#define WORDS_H
+
+enum Kind {
+    ADDRESS,
+    WIF,
+    WIF_COMPRESSED,
+    XPUB,
+    SSS_SHARE,
+    INVALID,
+    NUM_KINDS
+};
+
+// Check the word of len characters at w, and set *kind to what it is.
+// Return 0 if it is valid, or the reason why not, with *kind = INVALID.
+const char *check_word(const char *w, int len, enum Kind *kind);
+
+#endif
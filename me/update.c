@@ -228,6 +228,15 @@ static const char settings_txt[] =
 "#hd\r\n"
 "#hd m/44'/0'/0'\r\n"
 "\r\n"
+"# Split keys (click the button right after plugging in the device):\r\n"
+"# any M of N shares reveal the key; N is at most 15; the default is 2-of-3.\r\n"
+"#shamir 3-of-5\r\n"
+"\r\n"
+"# Image file: a JPEG file and the same image in a PDF file, or a smaller\r\n"
+"# black and white PNG file instead:\r\n"
+"image JPEG\r\n"
+"#image PNG\r\n"
+"\r\n"
 "# Advanced feature: up to 32 bytes of your own salt in hex, e.g.:\r\n"
 "#salt1 dead beef\r\n"
 "\r\n"
@@ -177,8 +177,8 @@ void xflash_periodic_interrupt(void)
 
 bool xflash_write_jpeg(void)
 {
-    uint8_t *bprev, *bptr = 0;
-    unsigned blk = 0;
+    unsigned nblk = (jpeg_size() + 511) / 512;
+    unsigned blk;
 
     uint32_t t, tprev = now(), t_erase, tmax_jpeg = 0, tmax_write = 0;
 
@@ -186,9 +186,8 @@ bool xflash_write_jpeg(void)
     t_erase = t - tprev;
     tprev = t;
 
-    do {
-        bprev = bptr;
-        bptr = jpeg_get_block(blk);
+    for (blk = 0; blk < nblk; blk++) {
+        uint8_t *bptr = jpeg_get_block(blk);
             t = now();
             if (t - tprev > tmax_jpeg) tmax_jpeg = t - tprev;
             tprev = t;
@@ -199,8 +198,7 @@ bool xflash_write_jpeg(void)
             t = now();
             if (t - tprev > tmax_write) tmax_write = t - tprev;
             tprev = t;
-        blk++;
-    } while (bptr != bprev);
+    }
 
     printf("xflash: erase remaining %lu, max jpeg gen %lu, max flash write %lu.\n",
            t_erase, tmax_jpeg, tmax_write);